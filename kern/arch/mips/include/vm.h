@@ -103,6 +103,12 @@ paddr_t ram_stealmem(unsigned long npages);
 paddr_t ram_freemem(unsigned long npages);
 void ram_getsize(paddr_t *lo, paddr_t *hi);
 
+/*
+ * Page directory the UTLB refill handler walks on each CPU; set by
+ * as_activate. See exception-mips1.S.
+ */
+extern vaddr_t cpupagedirs[];
+
 /*
  * TLB shootdown bits.
  *
@@ -113,7 +119,8 @@ struct tlbshootdown {
 	/*
 	 * Change this to what you need for your VM design.
 	 */
-	struct addrspace *ts_addrspace;
+	uint32_t ts_asid;	/* address space ID of the mapping */
+	uint32_t ts_asidgen;	/* ...and the generation it belongs to */
 	vaddr_t ts_vaddr;
 };
 	
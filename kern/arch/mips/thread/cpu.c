@@ -59,6 +59,12 @@
 vaddr_t cpustacks[MAXCPUS];
 vaddr_t cputhreads[MAXCPUS];
 
+/*
+ * Page directory of the address space active on each CPU, or 0, for
+ * the UTLB refill handler in exception-mips1.S. Indexed the same way.
+ */
+vaddr_t cpupagedirs[MAXCPUS];
+
 /*
  * Do machine-dependent initialization of the cpu structure or things
  * associated with a new cpu. Note that we're not running on the new
@@ -73,6 +73,32 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * The cycle counter, for timing short intervals. It is per CPU and
+ * wraps after about three minutes, so only differences of nearby
+ * readings on one CPU mean anything.
+ */
+uint32_t
+getcycles(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+uint32_t
+getcyclefreq(void)
+{
+	return CPU_FREQUENCY;
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -208,7 +208,7 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
 	uint32_t i;
 	uint32_t statval = LHD_WORKING;
-	int result;
+	int result = 0;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -225,12 +225,16 @@ lhd_io(struct device *d, struct uio *uio)
 		statval |= LHD_ISWRITE;
 	}
 
+	/*
+	 * Wait until nobody else is using the device. The device is
+	 * held for the whole request, so a multi-page transfer goes
+	 * through without other requests interleaving with it.
+	 */
+	P(lh->lh_clear);
+
 	/* Loop over all the sectors we were asked to do. */
 	for (i=0; i<len; i++) {
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
 		/*
 		 * Are we writing? If so, transfer the data to the
 		 * on-card buffer.
@@ -238,8 +242,7 @@ lhd_io(struct device *d, struct uio *uio)
 		if (uio->uio_rw == UIO_WRITE) {
 			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
 
@@ -263,16 +266,16 @@ lhd_io(struct device *d, struct uio *uio)
 			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
 		}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
+		/* If we failed, stop here. */
 		if (result) {
-			return result;
+			break;
 		}
 	}
 
-	return 0;
+	/* Tell another thread it's cleared to go ahead. */
+	V(lh->lh_clear);
+
+	return result;
 }
 
 /*
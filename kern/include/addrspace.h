@@ -36,18 +36,66 @@
 
 
 #include <vm.h>
+#include <pagetable.h>
+#include <swap.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
 
-#define VM_PAGES 20
+/* Pagedaemon free-frame watermarks for a coremap of N frames */
+#define VM_LOW_WATER(n)  ((n) / 10 + 1)
+#define VM_HIGH_WATER(n) ((n) / 5 + 2)
 
+/* Swap-in read-ahead window, in pages beyond the faulting one */
+#define VM_READAHEAD_INIT 2
+#define VM_READAHEAD_MAX  (SWAP_MAXCLUSTER - 1)
 
-#define PAGE_TABLE_ENTRIES 2500
+#define RESET_INTERVAL 10
 
-#define SWAP_FILE_ENTRIES 2500
+/*
+ * File-backed part of an address space: FM_FILESIZE bytes at FM_VADDR
+ * come from FM_VNODE at FM_OFFSET. Pages covered by a file mapping have
+ * PTE_FILE set and are read from the file until they are first written
+ * out to swap. The mapping holds a reference to the vnode.
+ */
+struct as_filemap {
+	vaddr_t fm_vaddr;
+	size_t fm_filesize;
+	off_t fm_offset;
+	struct vnode *fm_vnode;
+	struct as_filemap *fm_next;
+};
 
-#define RESET_INTERVAL 10
+/*
+ * A region of an address space: the pages from AR_START up to AR_END,
+ * with the same permissions and the same source for their first
+ * contents. An address space keeps its regions sorted by address and
+ * without overlaps, so a fault finds its region by binary search.
+ * Addresses outside every region are invalid.
+ *
+ * Text regions (those not writable) are never dirtied. Their pages
+ * come from the file again after eviction, and as_copy shares them
+ * without copy-on-write. The backing is kept for the record.
+ */
+#define AR_READ		0x1
+#define AR_WRITE	0x2
+#define AR_EXEC		0x4
+
+#define AR_TEXT		0	/* code and read-only data */
+#define AR_DATA		1	/* initialized data */
+#define AR_BSS		2	/* zero-initialized data past the file */
+#define AR_STACK	3
+
+#define AR_ZEROFILL	0	/* pages start out as zeros */
+#define AR_FILEBACKED	1	/* ...or partly from an as_filemap */
+
+struct as_region {
+	vaddr_t ar_start;		/* first page */
+	vaddr_t ar_end;			/* page after the last */
+	uint8_t ar_perm;		/* AR_READ etc. */
+	uint8_t ar_kind;		/* AR_TEXT etc. */
+	uint8_t ar_backing;		/* AR_ZEROFILL or AR_FILEBACKED */
+};
 
 /* 
  * Address space - data structure associated with the virtual memory
@@ -55,60 +103,15 @@ struct vnode;
  *
  * You write this.
  */
-struct swap_page
-{
-	vaddr_t vaddress;
-	size_t size;
-	bool is_stack;
-};
-
-struct swap_file
-{
-	char sf_file[10];
-	int sf_pages;
-	struct swap_page sf_pagemapping[SWAP_FILE_ENTRIES];
-};
-
-int read_page_from_swap(paddr_t, vaddr_t, struct addrspace *as);
-int write_page_to_swap(paddr_t, vaddr_t, struct addrspace *as);
-
-int copy_swap_file(struct swap_file* from, struct swap_file* to);
-
-int load_segment_to_swap_file(void* vaddr1,vaddr_t vaddr, size_t memsize);
 
-int update_page_frame_entry(vaddr_t vaddr_fault, paddr_t paddr_fault, bool vbit, bool dbit, int id_thread,struct addrspace* as);
+int read_page_from_swap(paddr_t paddr, unsigned swapindex);
+int read_pages_from_swap(paddr_t *paddrs, unsigned npages, unsigned swapindex);
+int write_page_to_swap(paddr_t paddr, unsigned swapindex);
+int write_pages_to_swap(paddr_t *paddrs, unsigned npages, unsigned swapindex);
 
+int update_page_frame_entry(vaddr_t vaddr_fault, paddr_t paddr_fault, bool dbit, struct addrspace* as, unsigned swapindex);
 
-struct page_table_entry
-{
-	bool vbit;
-	bool rbit;
-	bool dbit;
-	vaddr_t vaddress;
-	paddr_t paddress;
-};	
-
-
-
-struct page_table
-{
-	struct page_table_entry pt_entrytable[PAGE_TABLE_ENTRIES];
-	int pt_totalpages;
-};	
-
-static volatile int vm_ready = 0;
-
-static volatile int ref_bit_count = 0;
-
-struct lock *vm_lock;
-
-struct vm_manager* VM;
-
-struct vm_metrics* VM_STATS;
-
-struct lock *vm_metrics_lock;
-
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+extern struct vm_manager *VM;	/* the coremap and its tunables */
 
 // Methods
 
@@ -124,8 +127,16 @@ struct addrspace {
 #else
         /* Put stuff here for your VM system */
         struct page_table as_pagetable;
-        struct swap_file as_sf;
+        struct as_filemap *as_filemaps;
+        struct as_region *as_regions;	/* sorted by ar_start */
+        unsigned as_nregions;
+        unsigned as_maxregions;		/* room in as_regions */
         paddr_t as_stackpbase;
+        uint32_t as_asid;		/* TLB address space ID */
+        uint32_t as_asidgen;		/* generation of as_asid; 0 if none */
+        uint32_t as_cpus;		/* CPUs that have ever activated it */
+        struct lock *as_lock;		/* serializes faults and changes */
+        struct cv *as_cv;		/* waiters for a PTE_BUSY page */
 #endif
 };
 
@@ -138,9 +149,9 @@ struct addrspace {
  *                return NULL on out-of-memory error.
  *
  *    as_copy   - create a new address space that is an exact copy of
- *                an old one. Probably calls as_create to get a new
- *                empty address space and fill it in, but that's up to
- *                you.
+ *                an old one. Resident frames and swap slots are shared
+ *                copy-on-write rather than copied; vm_fault makes a
+ *                private copy on the first write to a shared page.
  *
  *    as_activate - make the specified address space the one currently
  *                "seen" by the processor. Argument might be NULL, 
@@ -150,7 +161,11 @@ struct addrspace {
  *                the way this works if implementing user-level threads.
  *
  *    as_define_region - set up a region of memory within the address
- *                space.
+ *                space. Writable regions are data, others text. A
+ *                page shared with a region already defined, at the
+ *                boundary of two ELF segments, becomes a region of
+ *                its own with the permissions of both. Any other
+ *                overlap fails with EINVAL.
  *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
@@ -158,9 +173,18 @@ struct addrspace {
  *    as_complete_load - this is called when loading from an executable
  *                is complete.
  *
+ *    as_define_file - back the start of an already defined segment
+ *                with a file; its pages are read from the file on
+ *                first touch. Whole pages of the segment past the file
+ *                become a zero-fill region of their own (bss), all of
+ *                it if no part is in the file.
+ *
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_evict_page - evict the page at VADDR, if it is in memory, as
+ *                the replacement policy would. For tests.
  */
 
 struct addrspace *as_create(void);
@@ -173,9 +197,14 @@ int               as_define_region(struct addrspace *as,
                                    int readable, 
                                    int writeable,
                                    int executable);
+int               as_define_file(struct addrspace *as,
+                                 vaddr_t vaddr, size_t memsize,
+                                 size_t filesize,
+                                 struct vnode *v, off_t offset);
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_evict_page(struct addrspace *as, vaddr_t vaddr);
 
 
 /*
@@ -187,10 +216,6 @@ int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
 int load_elf(struct vnode *v, vaddr_t *entrypoint);
 
-void stats_init(void);
-
-void print_stats(void);
-
 void reset_reference_bit(void);
 
 #endif /* _ADDRSPACE_H_ */
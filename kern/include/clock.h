@@ -67,6 +67,14 @@ void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
                  time_t *rsecs, uint32_t *rnsecs);
 
+/*
+ * getcycles() reads this CPU's cycle counter, which counts
+ * getcyclefreq() cycles a second and wraps around. Use it only for
+ * the difference between two nearby readings on the same CPU.
+ */
+uint32_t getcycles(void);
+uint32_t getcyclefreq(void);
+
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
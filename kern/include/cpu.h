@@ -60,6 +60,9 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	uint32_t c_asid;		/* Address space ID loaded in the MMU */
+	uint32_t c_asidgen;		/* ASID generation held by the TLB */
+	unsigned c_tlbnext;		/* TLB slots from here on free since flush */
 
 	/*
 	 * Accessed by other cpus.
@@ -86,6 +89,8 @@ struct cpu {
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	uint32_t c_shootdown_seq;	/* shootdown IPIs queued */
+	volatile uint32_t c_shootdown_done; /* ...and carried out */
 	struct spinlock c_ipi_lock;
 };
 
@@ -109,6 +114,13 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Number of CPUs found at boot, numbered 0 to cpu_count()-1, and the
+ * CPU with a given number.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned number);
+
 /*
  * Return a string describing the CPU type.
  */
@@ -152,6 +164,10 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_many sends N mappings with a single IPI. It returns
+ * a ticket; ipi_tlbshootdown_wait returns once the target has carried
+ * out that shootdown and all earlier ones. Wait only with interrupts
+ * on, so that two CPUs waiting on each other both get through.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,6 +182,9 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+uint32_t ipi_tlbshootdown_many(struct cpu *target,
+			       const struct tlbshootdown *mappings, unsigned n);
+void ipi_tlbshootdown_wait(struct cpu *target, uint32_t ticket);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page table, MIPS style.
+ *
+ * The top 10 bits of a virtual address index the directory, the next
+ * 10 bits index a leaf page of 1024 PTEs. The directory and the leaves
+ * are only allocated when a page in their range is first defined, so a
+ * small program costs one directory page plus one leaf per 4M of
+ * address space it actually uses.
+ *
+ * Each PTE is one 32-bit word. When the page is resident the upper 20
+ * bits hold the physical frame; otherwise they hold the page's offset
+ * (in pages) in the swap area. The VALID and DIRTY bits sit in the same
+ * positions as TLBLO_VALID and TLBLO_DIRTY.
+ *
+ * A page that is not resident comes back from its swap slot if it has
+ * one (SWAPPED), else from the file mappings of the address space if
+ * it is FILE, else it is demand-zero.
+ *
+ * BUSY marks a page that a fault is bringing in with the address
+ * space unlocked. Other faults on the page wait on the address space's
+ * CV until it is resident.
+ *
+ * COW marks a page whose frame or slot may also belong to another
+ * address space. It is never mapped writable; the first write goes
+ * through vm_fault, which copies the page if it is still shared.
+ */
+
+#include <vm.h>	/* for pte_t */
+
+#define PTE_FRAME     0xfffff000	/* physical frame, or swap offset */
+#define PTE_DIRTY     0x00000400	/* modified since last written to swap */
+#define PTE_VALID     0x00000200	/* resident in memory */
+#define PTE_REF       0x00000100	/* referenced */
+#define PTE_BUSY      0x00000010	/* being brought in; faults wait for it */
+#define PTE_COW       0x00000008	/* frame or slot may be shared; copy before writing */
+#define PTE_FILE      0x00000004	/* initial contents come from a file */
+#define PTE_SWAPPED   0x00000002	/* has a copy in the swap area */
+#define PTE_INUSE     0x00000001	/* page is part of the address space */
+
+#define PTE_SWAPSHIFT 12
+
+#define PTE_PADDR(pte)       ((paddr_t)((pte) & PTE_FRAME))
+#define PTE_SWAPINDEX(pte)   ((unsigned)((pte) >> PTE_SWAPSHIFT))
+#define PTE_MKSWAP(index)    ((pte_t)(index) << PTE_SWAPSHIFT)
+
+#define PT_DIRENTRIES   1024
+#define PT_LEAFENTRIES  1024
+#define PT_DIRINDEX(va)  ((vaddr_t)(va) >> 22)
+#define PT_LEAFINDEX(va) (((vaddr_t)(va) >> 12) & (PT_LEAFENTRIES - 1))
+#define PT_VADDR(d, l)   (((vaddr_t)(d) << 22) | ((vaddr_t)(l) << 12))
+
+struct page_table {
+	pte_t **pt_dir;			/* directory; NULL until first use */
+	unsigned pt_totalpages;		/* number of pages defined */
+};
+
+/*
+ * Functions in pagetable.c:
+ *
+ *    pt_init    - set up an empty page table.
+ *
+ *    pt_destroy - free the directory and all leaves. The caller is
+ *                 responsible for whatever the PTEs point to.
+ *
+ *    pt_lookup  - return the PTE for VADDR, or NULL if its leaf does
+ *                 not exist. The PTE may still be unused.
+ *
+ *    pt_define  - return the PTE for VADDR, allocating the directory
+ *                 and leaf as needed, and mark it in use. Returns NULL
+ *                 on out-of-memory.
+ */
+
+void   pt_init(struct page_table *pt);
+void   pt_destroy(struct page_table *pt);
+pte_t *pt_lookup(struct page_table *pt, vaddr_t vaddr);
+pte_t *pt_define(struct page_table *pt, vaddr_t vaddr);
+
+#endif /* _PAGETABLE_H_ */
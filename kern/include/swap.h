@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * System-wide swap area.
+ *
+ * Swap lives on a raw disk device that is opened once at boot and
+ * divided into page-sized slots. A bitmap records which slots are in
+ * use; the slot number of a page is kept in its PTE (or in its coremap
+ * entry while the page is resident). After fork a slot may be named by
+ * several PTEs, so each slot also carries a reference count.
+ *
+ * Functions:
+ *     swap_bootstrap - open the swap device and size the slot bitmap.
+ *     swap_shutdown  - close the swap device.
+ *     swap_alloc     - reserve a free slot. Returns ENOSPC if swap is
+ *                      full or there is no swap device.
+ *     swap_alloc_run - reserve NPAGES consecutive free slots.
+ *     swap_free      - drop a reference to a slot, releasing it when
+ *                      the last one goes.
+ *     swap_dup       - add a reference to a slot in use.
+ *     swap_shared    - true if a slot has more than one reference.
+ *     swap_read      - read one page from a slot into a kernel buffer.
+ *     swap_write     - write one page from a kernel buffer into a slot.
+ *     swap_readv     - read NPAGES consecutive slots starting at SLOT
+ *                      into the kernel buffers KBUFS[], in one transfer.
+ *                      At most SWAP_MAXCLUSTER pages.
+ *     swap_writev    - likewise, writing.
+ */
+
+#define SWAP_DEVICE "lhd1raw:"
+#define SWAP_MAXCLUSTER 8	/* most pages moved in one transfer */
+#define SWAP_NOSLOT   0xfffff	/* page has never been written out */
+#define SWAP_MAXSLOTS SWAP_NOSLOT	/* slots must fit a PTE and the coremap */
+
+void swap_bootstrap(void);
+void swap_shutdown(void);
+int  swap_alloc(unsigned *slot);
+int  swap_alloc_run(unsigned npages, unsigned *slot);
+void swap_free(unsigned slot);
+void swap_dup(unsigned slot);
+bool swap_shared(unsigned slot);
+int  swap_read(void *kbuf, unsigned slot);
+int  swap_write(void *kbuf, unsigned slot);
+int  swap_readv(void **kbufs, unsigned npages, unsigned slot);
+int  swap_writev(void **kbufs, unsigned npages, unsigned slot);
+
+#endif /* _SWAP_H_ */
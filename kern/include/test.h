@@ -67,6 +67,9 @@ int printfile(int, char **);
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
+int kpagestest(int, char **);
+int regiontest(int, char **);
+int cowtest(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
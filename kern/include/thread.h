@@ -43,7 +43,6 @@
 struct addrspace;
 struct cpu;
 struct vnode;
-struct vm_manager_page_entry;
 /* get machine-dependent defs */
 #include <machine/thread.h>
 
@@ -171,8 +170,6 @@ void schedule(void);
  */
 void thread_consider_migration(void);
 
-void update_pagetable(struct vm_manager_page_entry* page_entry);
-
 //struct addrspace* get_thread(int id_thread);
 
 #endif /* _THREAD_H_ */
@@ -45,9 +45,26 @@
 #define VM_FAULT_READONLY    2    /* A write to a readonly page was attempted*/
 
 
+/* Page replacement policies */
+#define VM_POLICY_REFSCAN    0    /* first unreferenced frame from frame 0 */
+#define VM_POLICY_CLOCK      1    /* second chance with a persistent hand */
+
+extern int vm_replacement_policy;
+
 /* Initialization function */
 void vm_bootstrap(void);
 
+/* Select the replacement policy by name ("clock" or "refscan") */
+int vm_setpolicy(const char *name);
+const char *vm_policyname(void);
+
+/*
+ * Called by the idle loop with interrupts off: zero one free frame for
+ * the pool of pre-zeroed frames, taking interrupts meanwhile as
+ * cpu_idle would. Returns false if there was nothing to do.
+ */
+bool vm_idle_zero(void);
+
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
@@ -60,32 +77,79 @@ void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
 
-struct vm_manager_page_entry
+/* Page table entry; the bits are in pagetable.h */
+typedef uint32_t pte_t;
+
+/*
+ * A mapping of a shared frame by an address space other than the
+ * frame's owner. Frames are shared copy-on-write after fork.
+ */
+struct vm_mapping
 {
-	paddr_t p_address;
-	int thread_id;
-	vaddr_t v_address;
-	bool dirty_bit;
-	bool valid_bit;
-	bool reference_bit;
-	bool is_free;
 	struct addrspace *as;
+	vaddr_t v_address;
+	pte_t *pte;		/* the PTE in AS mapping the frame */
+	struct vm_mapping *next;
 };
 
+/*
+ * Coremap entry, one per physical frame, packed into 20 bytes. The
+ * frame's physical address follows from its index. Fields that only
+ * matter in one state of the frame share storage:
+ *
+ *     in use by users - as, pte and sharers name its mappings; vpn
+ *                       is the owner's page.
+ *     free            - next_free and prev_free link the free list,
+ *                       or the list of pre-zeroed frames if zeroed.
+ *     wired           - kpages is the length of the run it starts.
+ */
+struct vm_manager_page_entry
+{
+	union {
+		struct addrspace *as;	/* the owner */
+		int next_free;		/* next entry on the free list, or -1 */
+	};
+	union {
+		pte_t *pte;		/* the owner's PTE, so eviction need not look it up */
+		int prev_free;		/* previous entry on the free list, or -1 */
+	};
+	union {
+		struct vm_mapping *sharers;	/* mappings other than (as, vpn) */
+		unsigned kpages;	/* length of the kernel run this entry starts */
+	};
+	unsigned vpn:20;		/* the owner's virtual page number */
+	unsigned is_free:1;
+	unsigned wired:1;		/* kernel memory; never chosen for eviction */
+	unsigned busy:1;		/* being written out by the pagedaemon */
+	unsigned transit:1;		/* being filled or evicted; faults wait */
+	unsigned prefetched:1;		/* brought in by read-ahead, not used yet */
+	unsigned dirty_bit:1;
+	unsigned reference_bit:1;
+	unsigned zeroed:1;		/* free and known to hold zeros */
+	unsigned swap_index:20;		/* slot of the page in the swap area, or SWAP_NOSLOT */
+	unsigned refcount:12;		/* address spaces mapping the frame */
+};
+
+#define COREMAP_MAXREFS 0xfff
+#define COREMAP_VADDR(e) ((vaddr_t)(e)->vpn << 12)
+
 
 struct vm_manager
 {
 	struct vm_manager_page_entry* page_frame_table;
 	int num_page_frames;
-};
-
-struct vm_metrics
-{
-	int tlb_misses;
-	int tlb_misses_with_page_in_memory;
-	int vm_fault_with_free_page;
-	int vm_fault_with_lru;
-	int page_fault;
+	paddr_t first_paddr;	/* frame of page_frame_table[0] */
+	int free_head;		/* first free entry, or -1 */
+	int zero_head;		/* first free entry known to be zeroed, or -1 */
+	int num_free;		/* free entries, on either list */
+	int num_zeroed;		/* ...of which on the zeroed list */
+	int zero_target;	/* idle CPUs zero frames up to this many */
+	int num_wired;		/* frames lent to the kernel by alloc_kpages */
+	int max_wired;		/* ...at most this many, so users keep enough */
+	int clock_hand;		/* next entry the clock policy looks at */
+	int readahead_window;	/* pages read ahead of a major fault */
+	int low_water;		/* pagedaemon wakes below this many free frames */
+	int high_water;		/* ...and frees frames up to this many */
 };
 
 #endif /* _VM_H_ */
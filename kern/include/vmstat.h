@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _VMSTAT_H_
+#define _VMSTAT_H_
+
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+
+/*
+ * VM statistics.
+ *
+ * Every CPU keeps its own counters and only ever updates its own, with
+ * no lock and no atomic operation; readers add them up over all CPUs.
+ * An increment can be lost if the thread migrates, or an interrupt
+ * bumps the same counter, in the middle of it. That is rare enough not
+ * to matter for statistics, and keeps the fault path free of locks.
+ *
+ * Latencies are kept as histograms in CPU cycles. Bucket 0 counts
+ * times under 2^VMSTAT_HISTSHIFT cycles, and each following bucket
+ * twice as long a range; the last one takes everything longer. The
+ * sum of the times, for the average, is kept in microseconds, so that
+ * it fits 32 bits for over an hour of waiting and needs no 64-bit
+ * division to print.
+ *
+ * Functions:
+ *     VMSTAT_INC/ADD - bump a counter of the current CPU.
+ *     vmstat_latency - record the cycles since START, a getcycles()
+ *                      reading, in the histogram KIND.
+ *     vmstat_sum     - add up all CPUs' statistics into VS.
+ *     vmstat_print   - print the statistics in NOW, or if SINCE is not
+ *                      NULL, how they changed from SINCE to NOW.
+ *     vmstat_watch   - print how they change over COUNT intervals of
+ *                      INTERVAL seconds each.
+ */
+
+/* Latency histograms */
+#define VMLAT_MINOR	0	/* fault on a resident page */
+#define VMLAT_MAJOR	1	/* fault that brought a page in */
+#define VMLAT_EVICT	2	/* eviction a fault or kmalloc waited for */
+#define VMLAT_PAGEIN	3	/* swap read transfer */
+#define VMLAT_PAGEOUT	4	/* swap write transfer */
+#define VMLAT_NKINDS	5
+
+#define VMSTAT_NBUCKETS		16
+#define VMSTAT_HISTSHIFT	8
+
+struct vmstat_hist {
+	uint32_t h_count[VMSTAT_NBUCKETS];
+	uint32_t h_us;			/* sum of all times recorded, in us */
+};
+
+/* Event counters; vmstat_sum treats these as an array of unsigned */
+struct vmstat_counters {
+	unsigned tlb_misses;		/* misses the UTLB refill handler passed on */
+	unsigned tlb_misses_with_page_in_memory;
+	unsigned vm_fault_with_free_page;
+	unsigned vm_fault_with_lru;
+	unsigned page_fault;
+	unsigned page_ins;		/* pages read from swap */
+	unsigned page_outs;		/* pages written to swap */
+	unsigned dirty_faults;		/* writes to pages mapped read-only while clean */
+	unsigned clean_evictions;	/* evictions that needed no write */
+	unsigned pagedaemon_wakeups;
+	unsigned pagedaemon_cleaned;	/* dirty pages written out by the pagedaemon */
+	unsigned pagedaemon_freed;	/* frames put on the free list by the pagedaemon */
+	unsigned prefetch_issued;	/* pages brought in by read-ahead */
+	unsigned prefetch_hits;		/* ...that were used before leaving memory */
+	unsigned prefetch_wasted;	/* ...that left memory unused */
+	unsigned pageout_clusters;	/* pagedaemon write transfers */
+	unsigned zero_fills;		/* first touches of demand-zero pages */
+	unsigned zero_pool_hits;	/* first touches given a pre-zeroed frame */
+	unsigned zero_pool_misses;	/* ...or that had to zero it themselves */
+	unsigned zero_pool_filled;	/* frames zeroed by idle CPUs */
+	unsigned file_fills;		/* pages read straight from a file mapping */
+	unsigned cow_shared;		/* pages shared by as_copy */
+	unsigned cow_copies;		/* write faults that copied a shared frame */
+	unsigned cow_reuses;		/* write faults that found the frame unshared */
+	unsigned asid_rollovers;	/* new ASID generations, each costing a flush per CPU */
+	unsigned tlb_flushes;		/* whole-TLB flushes, on any CPU */
+	unsigned tlb_invalidations;	/* single entries removed with tlb_probe */
+	unsigned tlb_ipis;		/* shootdown IPIs sent to other CPUs */
+	unsigned tlb_shootdowns;	/* single-page invalidations they carried */
+	unsigned tlb_replacements;	/* valid entries displaced to make room */
+	unsigned kpages_coremap;	/* kernel pages allocated from the coremap */
+	unsigned kpages_freed;		/* kernel pages given back to the coremap */
+	unsigned kpages_reclaimed;	/* user frames evicted to make a kernel run */
+};
+
+struct vmstat {
+	struct vmstat_counters vs_count;
+	struct vmstat_hist vs_lat[VMLAT_NKINDS];
+};
+
+extern struct vmstat vmstat_cpus[MAXCPUS];
+
+#define VMSTAT_ADD(field, n) \
+	(vmstat_cpus[curcpu->c_number].vs_count.field += (n))
+#define VMSTAT_INC(field) VMSTAT_ADD(field, 1)
+
+void vmstat_latency(unsigned kind, uint32_t start);
+void vmstat_sum(struct vmstat *vs);
+void vmstat_print(const struct vmstat *now, const struct vmstat *since);
+int vmstat_watch(int interval, int count);
+
+#endif /* _VMSTAT_H_ */
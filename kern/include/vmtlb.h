@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _VMTLB_H_
+#define _VMTLB_H_
+
+/*
+ * TLB management for the VM system.
+ *
+ * Entries are tagged with the address space ID (ASID) of their address
+ * space, so the TLB is not flushed on a context switch. After a flush
+ * a CPU fills free slots in order; once the TLB is full a new entry
+ * displaces a random one. Single pages are removed with tlb_probe, on
+ * every CPU that might hold them.
+ *
+ * Each address space records which CPUs have ever run it; only those
+ * can hold its entries. Invalidations are gathered in a struct
+ * vmtlb_batch and go out as one IPI per CPU.
+ *
+ * Functions:
+ *     vmtlb_activate      - load the ASID and page directory of AS on
+ *                           this CPU, assigning an ASID if it has none
+ *                           of the current generation. AS may be NULL.
+ *     vmtlb_deactivate    - forget AS, which is being destroyed: no
+ *                           CPU's refill handler looks at its page
+ *                           directory any more, and this CPU stops
+ *                           using its ASID. Other CPUs may keep the
+ *                           ASID loaded, but only while they run
+ *                           kernel threads, which make no user
+ *                           accesses. It is not handed out again
+ *                           before the next generation, which every
+ *                           CPU flushes before use.
+ *     vmtlb_newgeneration - start a new ASID generation; every CPU
+ *                           flushes before its next activation.
+ *     vmtlb_flush         - drop every entry of this CPU's TLB.
+ *     vmtlb_batch_init    - start an empty batch.
+ *     vmtlb_batch_add     - drop the translation for VADDR in AS from
+ *                           this CPU's TLB now and queue it for the
+ *                           other CPUs that may hold it. A full batch
+ *                           is sent on the spot.
+ *     vmtlb_batch_send    - send the queued invalidations, without
+ *                           waiting for them.
+ *     vmtlb_batch_wait    - send, then wait until every CPU sent to has
+ *                           carried out its invalidations. Must not be
+ *                           called with a spinlock held. Only then may
+ *                           the frames involved be reused or written.
+ *     vmtlb_load          - enter VADDR -> ELO (TLBLO bits) for the
+ *                           current address space in this CPU's TLB.
+ */
+
+#include <platform/maxcpus.h>
+#include <vm.h>
+
+struct addrspace;
+
+struct vmtlb_batch {
+	unsigned tb_n;				/* queued entries */
+	struct tlbshootdown tb_ents[TLBSHOOTDOWN_MAX];
+	uint32_t tb_cpus[TLBSHOOTDOWN_MAX];	/* CPUs each must go to */
+	uint32_t tb_waitcpus;			/* CPUs sent to, not waited on */
+	uint32_t tb_tickets[MAXCPUS];		/* last ticket of each */
+};
+
+void vmtlb_activate(struct addrspace *as);
+void vmtlb_deactivate(struct addrspace *as);
+void vmtlb_newgeneration(void);
+void vmtlb_flush(void);
+void vmtlb_batch_init(struct vmtlb_batch *b);
+void vmtlb_batch_add(struct vmtlb_batch *b, struct addrspace *as, vaddr_t vaddr);
+void vmtlb_batch_send(struct vmtlb_batch *b);
+void vmtlb_batch_wait(struct vmtlb_batch *b);
+void vmtlb_load(vaddr_t vaddr, uint32_t elo);
+
+#endif /* _VMTLB_H_ */
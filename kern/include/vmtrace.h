@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _VMTRACE_H_
+#define _VMTRACE_H_
+
+/*
+ * Page fault tracing.
+ *
+ * While tracing is on, every fault and every eviction is recorded in
+ * a ring buffer of the CPU it happens on; when a buffer is full the
+ * oldest records are overwritten. A dump merges the buffers in time
+ * order into a text file, normally on the host through emufs, for
+ * tools/vmsim to replay against other replacement policies. Each line
+ * of the dump is
+ *
+ *     secs.nsecs cpu kind rw as vpn frame
+ *
+ * where secs.nsecs is the time since tracing was first started, kind
+ * is one of the VMTRACE_ characters below, rw is r or w (- for
+ * evictions and exits), as names the address space by its kernel
+ * address in hex, vpn is in hex and frame is the coremap index of the
+ * frame the page is in, or was evicted from, or -1.
+ *
+ * Functions:
+ *     VMTRACE       - record an event if tracing is on. Costs a test
+ *                     of vmtrace_enabled otherwise.
+ *     vmtrace_start - allocate the buffers if need be and start
+ *                     recording.
+ *     vmtrace_stop  - stop recording; the buffers are kept.
+ *     vmtrace_dump  - write the records to the file PATH and empty
+ *                     the buffers.
+ */
+
+#define VMTRACE_MINOR	'm'	/* fault on a resident page */
+#define VMTRACE_MAJOR	'M'	/* fault that brought the page in */
+#define VMTRACE_EVICT	'E'	/* page taken from its frame */
+#define VMTRACE_EXIT	'X'	/* address space destroyed */
+
+#define VMTRACE_NRECS	2048	/* records per CPU */
+
+struct addrspace;
+
+extern volatile bool vmtrace_enabled;
+
+#define VMTRACE(kind, write, as, vaddr, frame) \
+	do { \
+		if (vmtrace_enabled) \
+			vmtrace_record(kind, write, as, vaddr, frame); \
+	} while (0)
+
+void vmtrace_record(int kind, bool write, struct addrspace *as,
+		    vaddr_t vaddr, int frame);
+int vmtrace_start(void);
+void vmtrace_stop(void);
+int vmtrace_dump(const char *path);
+
+#endif /* _VMTRACE_H_ */
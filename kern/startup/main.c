@@ -50,6 +50,7 @@
 #include <vnode.h>
 #include <vfs.h>
 #include <uio.h>
+#include <swap.h>
 #include "autoconf.h"  // for pseudoconfig
 
 
@@ -194,6 +195,7 @@ shutdown(void)
 
 	kprintf("Shutting down.\n");
 	
+	swap_shutdown();
 	vfs_clearbootfs();
 	vfs_clearcurdir();
 	vfs_unmountall();
@@ -37,6 +37,9 @@
 #include <clock.h>
 #include <thread.h>
 #include <vfs.h>
+#include <vm.h>
+#include <vmstat.h>
+#include <vmtrace.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
@@ -368,6 +371,100 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+/*
+ * Command to show or change the page replacement policy.
+ */
+static
+int
+cmd_vmpolicy(int nargs, char **args)
+{
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: vmpolicy [clock|refscan]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2) {
+		result = vm_setpolicy(args[1]);
+		if (result) {
+			kprintf("Usage: vmpolicy [clock|refscan]\n");
+			return result;
+		}
+	}
+
+	kprintf("Page replacement policy: %s\n", vm_policyname());
+	return 0;
+}
+
+/*
+ * Command to print VM statistics: the totals since boot, or with an
+ * interval, what changed in each of COUNT intervals of that many
+ * seconds.
+ */
+static
+int
+cmd_vmstat(int nargs, char **args)
+{
+	struct vmstat *vs;
+	int interval, count;
+
+	if (nargs > 3) {
+		kprintf("Usage: vmstat [interval [count]]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 1) {
+		vs = kmalloc(sizeof(*vs));
+		if (vs == NULL) {
+			return ENOMEM;
+		}
+		vmstat_sum(vs);
+		vmstat_print(vs, NULL);
+		kfree(vs);
+		return 0;
+	}
+
+	interval = atoi(args[1]);
+	count = nargs == 3 ? atoi(args[2]) : 10;
+	if (interval <= 0 || count <= 0) {
+		kprintf("Usage: vmstat [interval [count]]\n");
+		return EINVAL;
+	}
+	return vmstat_watch(interval, count);
+}
+
+/*
+ * Command to control page fault tracing. "dump" writes the trace to
+ * a file, such as emu0:trace, for tools/vmsim.
+ */
+static
+int
+cmd_vmtrace(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		result = vmtrace_start();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		vmtrace_stop();
+		result = 0;
+	}
+	else if (nargs == 3 && !strcmp(args[1], "dump")) {
+		result = vmtrace_dump(args[2]);
+	}
+	else {
+		kprintf("Usage: vmtrace on|off|dump file\n");
+		return EINVAL;
+	}
+
+	if (result) {
+		kprintf("vmtrace: %s\n", strerror(result));
+	}
+	return result;
+}
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -440,6 +537,9 @@ static const char *testmenu[] = {
 	"[bt]  Bitmap test                   ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
+	"[km3] Kernel page allocation test   ",
+	"[vm1] Address space region test     ",
+	"[vm2] Copy-on-write test            ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -485,6 +585,9 @@ static const char *mainmenu[] = {
 #endif
 #endif
 	"[kh] Kernel heap stats              ",
+	"[vmpolicy] Page replacement policy  ",
+	"[vmstat] VM statistics              ",
+	"[vmtrace] Page fault tracing        ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -541,12 +644,18 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "vmpolicy",	cmd_vmpolicy },
+	{ "vmstat",	cmd_vmstat },
+	{ "vmtrace",	cmd_vmtrace },
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "bt",		bitmaptest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
+	{ "km3",	kpagestest },
+	{ "vm1",	regiontest },
+	{ "vm2",	cowtest },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
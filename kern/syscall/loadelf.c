@@ -61,6 +61,7 @@
 #include <elf.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <stat.h>
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -82,7 +83,7 @@
  * read the segement from executable file and then put the complete segment in memory.
  * Which is not desired when using 
  * demand paging. Demand pagin reads the segements from the executable file
- * and put it back in the swap space which is, in our implementation is, merely an another file.
+ * and put it back in the swap space, which is a slot on the swap device.
  */
 
 #if 0
@@ -160,7 +161,10 @@ load_segment(struct vnode *v, off_t offset, vaddr_t vaddr,
 
 /*
  * This is our version of load_segment function written particulary to support
- * demand paging.
+ * demand paging. Nothing is read here: the file part of the segment is
+ * recorded as a file-backed mapping of the address space, and its pages
+ * are read straight from the executable when they are first touched.
+ * The rest of the segment (BSS) is demand-zero.
  */
 #define comment 0
 
@@ -170,16 +174,11 @@ load_segment(struct vnode *progv, off_t progoffset, vaddr_t user_vaddr, size_t m
 {
 		
 	#if comment 
-	kprintf("load_segment called : uservaddr %x memsize : %d filesize : %d", user_vaddr,memsize,filesize); 
+	kprintf("load_segment called : uservaddr %x memsize : %d filesize : %d\n", user_vaddr,memsize,filesize); 
 	#endif
 	
-	size_t sz = memsize,sfoffset,memlen,filelen; 
-	int i,j,npages;
 	struct addrspace *as = curthread->t_addrspace;
-	struct swap_file *sf = &(as->as_sf);
-	struct iovec progiov, sfiov;
-	struct uio progu, sfu;
-	struct vnode * sfv;
+	struct stat st;
 	int result;
 
 	(void)is_executable;
@@ -189,192 +188,21 @@ load_segment(struct vnode *progv, off_t progoffset, vaddr_t user_vaddr, size_t m
 		filesize = memsize;
 	}
 
-	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n", 
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes to 0x%lx\n", 
 	      (unsigned long) filesize, (unsigned long) user_vaddr);
-	
-	//finding number of pages in the segment
-	sz += user_vaddr & ~(vaddr_t)PAGE_FRAME;
-	vaddr_t vaddr = user_vaddr;
-	vaddr &= PAGE_FRAME;
-	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
 
-	npages = sz / PAGE_SIZE;
-	#if comment 
-	kprintf(" npages : %d \n",npages);
-	#endif
-	
-	/*
-	 * read a segment page by page into kernel space(pointed by ktemp) from executable file and
-	 * write it back in swap file
-	 */
-	
-	
-	void* ktemp = kmalloc(PAGE_SIZE);
-	bzero(ktemp, PAGE_SIZE);
-	
-	result = vfs_open(sf->sf_file, 6, 0664, &sfv);
+	/* Catch a truncated executable now rather than at fault time */
+	result = VOP_STAT(progv, &st);
 	if (result) {
 		return result;
 	}
-	
-	for(i=1;i<=npages;i++)
-	{
-		//finding out the offset where this page is to written in swap file
-		for(j=0;j<sf->sf_pages;j++)
-		{
-			if((sf->sf_pagemapping[j].vaddress & PAGE_FRAME) == (vaddr & PAGE_FRAME))
-			{
-				 sfoffset = j;
-				 break;
-			}
-		}
-		
-		//if page is first page of the segment
-		if(i==1)
-		{
-			if(memsize+user_vaddr-vaddr <= PAGE_SIZE)
-			{	
-				memlen = memsize;
-				filelen = filesize;
-			}
-			else
-			{
-				memlen = PAGE_SIZE+vaddr-user_vaddr;
-				if(filesize > memlen)
-					filelen = memlen;
-				else
-					filelen = filesize;
-			}
-				
-			progiov.iov_ubase = ktemp;
-			progiov.iov_len = memlen;		 // length of the memory space
-			progu.uio_iov = &progiov;
-			progu.uio_iovcnt = 1;
-			progu.uio_resid = filelen;          // amount to read from the file
-			progu.uio_offset = progoffset;
-			progu.uio_segflg = UIO_SYSSPACE;
-			progu.uio_rw = UIO_READ;
-			progu.uio_space = NULL;
-	
-			sfiov.iov_ubase = ktemp;
-			sfiov.iov_len = memlen;
-			sfu.uio_iov = &sfiov;
-			sfu.uio_iovcnt = 1;
-			sfu.uio_resid = memlen;          // amount to read from the file
-			sfu.uio_offset = sfoffset*PAGE_SIZE;
-			sfu.uio_segflg = UIO_SYSSPACE;
-			sfu.uio_rw = UIO_WRITE;
-			sfu.uio_space = NULL;
-			#if comment
-			kprintf("load_elf:\n reading page %d from prog file\n progoffset : %lld memlen : %d filelen : %d \n",i,progoffset,memlen,filelen);
-			kprintf(" writing page to swap file\n sfoffset : %d memlen : %d vaddr : %x\n",sfoffset,memlen,vaddr);
-			#endif
-		}
-		//if page is last page of the segment
-		else if(i==npages)
-		{	
-			memlen = memsize;
-			if(filesize > 0)
-				filelen = filesize;
-			else
-				filelen = 0;
-			progiov.iov_ubase = ktemp;
-			progiov.iov_len = memlen;		 // length of the memory space
-			progu.uio_iov = &progiov;
-			progu.uio_iovcnt = 1;
-			progu.uio_resid = filelen;          // amount to read from the file
-			progu.uio_offset = progoffset;
-			progu.uio_segflg = UIO_SYSSPACE;
-			progu.uio_rw = UIO_READ;
-			progu.uio_space = NULL;
-			
-			sfiov.iov_ubase = ktemp;
-			sfiov.iov_len = memlen;
-			sfu.uio_iov = &sfiov;
-			sfu.uio_iovcnt = 1;
-			sfu.uio_resid = memlen;          // amount to read from the file
-			sfu.uio_offset = sfoffset*PAGE_SIZE;
-			sfu.uio_segflg = UIO_SYSSPACE;
-			sfu.uio_rw = UIO_WRITE;
-			sfu.uio_space = NULL;
-			#if comment
-			kprintf("load_elf:\n reading page %d from prog file\n progoffset : %lld memlen : %d filelen : %d \n",i,progoffset,memlen,filelen);
-			kprintf(" writing page to swap file\n sfoffset : %d memlen : %d vaddr : %x\n",sfoffset,memlen,vaddr);
-			#endif
-		}
-		//if page is neither first or last page of the segment
-		else
-		{
-			memlen = PAGE_SIZE;
-			if(filesize > 0)
-			{
-				if(filesize > memlen)
-					filelen = memlen;
-				else
-					filelen = filesize;
-			}
-			else
-				filelen = 0;
-			progiov.iov_ubase = ktemp;
-			progiov.iov_len = memlen;		 // length of the memory space
-			progu.uio_iov = &progiov;
-			progu.uio_iovcnt = 1;
-			progu.uio_resid = filelen;          // amount to read from the file
-			progu.uio_offset = progoffset;
-			progu.uio_segflg = UIO_SYSSPACE;
-			progu.uio_rw = UIO_READ;
-			progu.uio_space = NULL;
-			
-			sfiov.iov_ubase = ktemp;
-			sfiov.iov_len = memlen;
-			sfu.uio_iov = &sfiov;
-			sfu.uio_iovcnt = 1;
-			sfu.uio_resid = memlen;          // amount to read from the file
-			sfu.uio_offset = sfoffset*PAGE_SIZE;
-			sfu.uio_segflg = UIO_SYSSPACE;
-			sfu.uio_rw = UIO_WRITE;
-			sfu.uio_space = NULL;
-			#if comment
-			kprintf("load_elf:\n reading page %d from prog file\n progoffset : %lld memlen : %d filelen : %d \n",i,progoffset,memlen,filelen);
-			kprintf(" writing page to swap file\n sfoffset : %d memlen : %d vaddr : %x\n",sfoffset,memlen,vaddr);
-			#endif
-		}
-		
-		result = VOP_READ(progv, &progu);			//read from executable file
-		
-		if (result) {
-			kprintf("cannot read prog file\n");
-			return result;
-		}
-
-		if (progu.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on segment - file truncated?\n");
-			return ENOEXEC;
-		}
-		/*if(progoffset == 0)
-		{int k;
-		kprintf("printing segment\n");
-		for(k=0;k<memsize;k++)
-			kprintf("%c ",*((char*)(ktemp+k)));
-		kprintf("\nend printing segment\n");
-		}*/
-		result = VOP_WRITE(sfv, &sfu);				//write to swap file
-		if (result) {
-			kprintf("cannot write to swap file\n");
-			return result;
-		}
-		
-		vaddr += PAGE_SIZE;
-		memsize-=memlen;
-		progoffset += filelen;
-		filesize -= filelen;
-		bzero(ktemp, PAGE_SIZE);
-		
+	if (progoffset + (off_t)filesize > st.st_size) {
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
 	}
-	
-	kfree(ktemp);
-	return 0;
+
+	return as_define_file(as, user_vaddr, memsize, filesize, progv,
+			      progoffset);
 }
 /*
  * Load an ELF executable user program into the current address space.
@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Test code for copy-on-write sharing. Faults pages into an address
+ * space, copies it with as_copy, and writes through each copy, with
+ * a shared frame evicted on the way. The test thread runs in each
+ * address space in turn and touches its pages with copyin/copyout.
+ * Needs swap.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <thread.h>
+#include <current.h>
+#include <copyinout.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <vmstat.h>
+#include <addrspace.h>
+#include <test.h>
+
+/* one read-only page, then CT_NPAGES writable ones */
+#define CT_TEXT		0x400000
+#define CT_DATA		(CT_TEXT + PAGE_SIZE)
+#define CT_NPAGES	4
+
+static char *ct_buf;
+static struct vmstat ct_now;
+
+static
+void
+cowtest_switch(struct addrspace *as)
+{
+	curthread->t_addrspace = as;
+	as_activate(as);
+}
+
+static
+pte_t
+cowtest_pte(struct addrspace *as, vaddr_t va)
+{
+	pte_t *pte;
+
+	pte = pt_lookup(&as->as_pagetable, va);
+	KASSERT(pte != NULL);
+	return *pte;
+}
+
+/* The coremap entry of the frame holding the page, or NULL */
+static
+struct vm_manager_page_entry *
+cowtest_frame(struct addrspace *as, vaddr_t va)
+{
+	pte_t pte;
+
+	pte = cowtest_pte(as, va);
+	if ((pte & PTE_VALID) == 0) {
+		return NULL;
+	}
+	return &VM->page_frame_table[(PTE_PADDR(pte) - VM->first_paddr)
+				     / PAGE_SIZE];
+}
+
+static
+unsigned
+cowtest_refs(struct addrspace *as, vaddr_t va)
+{
+	struct vm_manager_page_entry *e;
+
+	e = cowtest_frame(as, va);
+	return e == NULL ? 0 : e->refcount;
+}
+
+static
+bool
+cowtest_write(struct addrspace *as, vaddr_t va, char c)
+{
+	unsigned i;
+	int result;
+
+	cowtest_switch(as);
+	for (i=0; i<PAGE_SIZE; i++) {
+		ct_buf[i] = c;
+	}
+	result = copyout(ct_buf, (userptr_t)va, PAGE_SIZE);
+	if (result) {
+		kprintf("write at 0x%x: %s; test failed.\n", va,
+			strerror(result));
+		return false;
+	}
+	return true;
+}
+
+static
+bool
+cowtest_read(struct addrspace *as, vaddr_t va, char c)
+{
+	unsigned i;
+	int result;
+
+	cowtest_switch(as);
+	result = copyin((const_userptr_t)va, ct_buf, PAGE_SIZE);
+	if (result) {
+		kprintf("read at 0x%x: %s; test failed.\n", va,
+			strerror(result));
+		return false;
+	}
+	for (i=0; i<PAGE_SIZE; i++) {
+		if (ct_buf[i] != c) {
+			kprintf("0x%x holds %d, not %d; test failed.\n",
+				va + i, ct_buf[i], c);
+			return false;
+		}
+	}
+	return true;
+}
+
+static
+bool
+cowtest_check(bool ok, const char *what)
+{
+	if (!ok) {
+		kprintf("%s; test failed.\n", what);
+	}
+	return ok;
+}
+
+/*
+ * A fresh address space with a text page and CT_NPAGES data pages
+ * in memory, the data page I holding 'a' + I.
+ */
+static
+struct addrspace *
+cowtest_create(void)
+{
+	struct addrspace *as;
+	unsigned i;
+	int result;
+
+	as = as_create();
+	if (as == NULL) {
+		kprintf("as_create failed; test failed.\n");
+		return NULL;
+	}
+	result = as_define_region(as, CT_TEXT, PAGE_SIZE, 1, 0, 1);
+	if (result == 0) {
+		result = as_define_region(as, CT_DATA, CT_NPAGES * PAGE_SIZE,
+					  1, 1, 0);
+	}
+	if (result) {
+		kprintf("as_define_region: %s; test failed.\n",
+			strerror(result));
+		as_destroy(as);
+		return NULL;
+	}
+	if (!cowtest_read(as, CT_TEXT, 0)) {
+		goto fail;
+	}
+	for (i=0; i<CT_NPAGES; i++) {
+		if (!cowtest_write(as, CT_DATA + i * PAGE_SIZE, 'a' + i)) {
+			goto fail;
+		}
+	}
+	return as;
+
+ fail:
+	cowtest_switch(NULL);
+	as_destroy(as);
+	return NULL;
+}
+
+/*
+ * Copy AS and check that every page is shared: copy-on-write for
+ * data, plainly for text. Returns the copy.
+ */
+static
+struct addrspace *
+cowtest_copy(struct addrspace *as)
+{
+	struct addrspace *copy;
+	unsigned i, shared;
+	vaddr_t va;
+	int result;
+
+	vmstat_sum(&ct_now);
+	shared = ct_now.vs_count.cow_shared;
+	result = as_copy(as, &copy);
+	if (result) {
+		kprintf("as_copy: %s; test failed.\n", strerror(result));
+		return NULL;
+	}
+	vmstat_sum(&ct_now);
+	if (!cowtest_check(ct_now.vs_count.cow_shared - shared == CT_NPAGES,
+			   "as_copy: cow_shared is off") ||
+	    !cowtest_check(cowtest_refs(as, CT_TEXT) == 2 &&
+			   ((cowtest_pte(as, CT_TEXT) |
+			     cowtest_pte(copy, CT_TEXT)) & PTE_COW) == 0,
+			   "as_copy: text page not shared as it is")) {
+		goto fail;
+	}
+	for (i=0; i<CT_NPAGES; i++) {
+		va = CT_DATA + i * PAGE_SIZE;
+		if (!cowtest_check(cowtest_refs(as, va) == 2 &&
+				   cowtest_frame(as, va) ==
+				   cowtest_frame(copy, va) &&
+				   (cowtest_pte(as, va) & PTE_COW) &&
+				   (cowtest_pte(copy, va) & PTE_COW),
+				   "as_copy: data page not shared")) {
+			goto fail;
+		}
+	}
+	return copy;
+
+ fail:
+	cowtest_switch(NULL);
+	as_destroy(copy);
+	return NULL;
+}
+
+/*
+ * Writes through both copies, and the eviction of a shared frame.
+ * Page 0 is copied, then reused; page 1 is evicted while shared.
+ */
+static
+bool
+cowtest_writes(struct addrspace *as, struct addrspace *copy)
+{
+	struct vm_manager_page_entry *e;
+	unsigned copies, reuses, slot;
+	vaddr_t va;
+	int result;
+
+	vmstat_sum(&ct_now);
+	copies = ct_now.vs_count.cow_copies;
+	reuses = ct_now.vs_count.cow_reuses;
+
+	/* the copy writes first, and gets a frame of its own */
+	va = CT_DATA;
+	e = cowtest_frame(as, va);
+	if (!cowtest_write(copy, va, 'x')) {
+		return false;
+	}
+	vmstat_sum(&ct_now);
+	if (!cowtest_check(ct_now.vs_count.cow_copies == copies + 1,
+			   "write to a shared page: cow_copies is off") ||
+	    !cowtest_check(cowtest_frame(as, va) == e && e->refcount == 1 &&
+			   e->as == as &&
+			   cowtest_frame(copy, va) != e &&
+			   (cowtest_pte(copy, va) & (PTE_COW|PTE_DIRTY)) ==
+			   PTE_DIRTY,
+			   "write to a shared page: frames are off") ||
+	    !cowtest_read(as, va, 'a') || !cowtest_read(copy, va, 'x')) {
+		return false;
+	}
+
+	/* now the parent, which takes the frame over */
+	if (!cowtest_write(as, va, 'y')) {
+		return false;
+	}
+	vmstat_sum(&ct_now);
+	if (!cowtest_check(ct_now.vs_count.cow_reuses == reuses + 1,
+			   "write to an unshared page: cow_reuses is off") ||
+	    !cowtest_check(cowtest_frame(as, va) == e &&
+			   (cowtest_pte(as, va) & PTE_COW) == 0,
+			   "write to an unshared page: frame is off") ||
+	    !cowtest_read(as, va, 'y') || !cowtest_read(copy, va, 'x')) {
+		return false;
+	}
+
+	/* evicted while shared, both copies take a reference to the slot */
+	va = CT_DATA + PAGE_SIZE;
+	result = as_evict_page(as, va);
+	if (result) {
+		kprintf("as_evict_page: %s; test failed.\n", strerror(result));
+		return false;
+	}
+	slot = PTE_SWAPINDEX(cowtest_pte(as, va));
+	if (!cowtest_check((cowtest_pte(as, va) &
+			    (PTE_VALID|PTE_SWAPPED|PTE_COW)) ==
+			   (PTE_SWAPPED|PTE_COW) &&
+			   cowtest_pte(copy, va) == cowtest_pte(as, va) &&
+			   swap_shared(slot),
+			   "eviction of a shared frame: slot is off")) {
+		return false;
+	}
+
+	/*
+	 * The copy brings it back in, unshared, and writes; it drops its
+	 * reference to the slot, which the parent still needs.
+	 */
+	if (!cowtest_read(copy, va, 'b') || !cowtest_write(copy, va, 'z')) {
+		return false;
+	}
+	vmstat_sum(&ct_now);
+	if (!cowtest_check(ct_now.vs_count.cow_reuses == reuses + 2,
+			   "write after page-in: cow_reuses is off") ||
+	    !cowtest_check(!swap_shared(slot) &&
+			   (cowtest_pte(copy, va) & (PTE_SWAPPED|PTE_COW)) == 0,
+			   "write after page-in: slot is off") ||
+	    !cowtest_read(as, va, 'b') || !cowtest_read(copy, va, 'z')) {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Destroy FIRST, then check that SECOND still has all its pages, the
+ * shared ones now its own, and destroy it too.
+ */
+static
+bool
+cowtest_destroy(struct addrspace *first, struct addrspace *second)
+{
+	struct vm_manager_page_entry *e;
+	unsigned i;
+	vaddr_t va;
+	bool ok;
+
+	cowtest_switch(NULL);
+	as_destroy(first);
+
+	ok = true;
+	for (i=2; ok && i<CT_NPAGES; i++) {
+		va = CT_DATA + i * PAGE_SIZE;
+		e = cowtest_frame(second, va);
+		ok = cowtest_check(e != NULL && e->refcount == 1 &&
+				   e->as == second && e->sharers == NULL,
+				   "as_destroy: frame not left to the other") &&
+			cowtest_read(second, va, 'a' + i);
+	}
+	ok = ok && cowtest_read(second, CT_TEXT, 0);
+
+	cowtest_switch(NULL);
+	as_destroy(second);
+	return ok;
+}
+
+int
+cowtest(int nargs, char **args)
+{
+	struct addrspace *as, *copy;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting copy-on-write test...\n");
+	KASSERT(curthread->t_addrspace == NULL);
+
+	ct_buf = kmalloc(PAGE_SIZE);
+	if (ct_buf == NULL) {
+		kprintf("kmalloc failed; test failed.\n");
+		return ENOMEM;
+	}
+
+	/* parent destroyed first: the copy becomes the frames' owner */
+	as = cowtest_create();
+	copy = as == NULL ? NULL : cowtest_copy(as);
+	if (copy != NULL) {
+		if (cowtest_writes(as, copy)) {
+			cowtest_destroy(as, copy);
+		}
+		else {
+			cowtest_switch(NULL);
+			as_destroy(copy);
+			as_destroy(as);
+		}
+	}
+	else if (as != NULL) {
+		cowtest_switch(NULL);
+		as_destroy(as);
+	}
+
+	/* copy destroyed first */
+	as = cowtest_create();
+	copy = as == NULL ? NULL : cowtest_copy(as);
+	if (copy != NULL) {
+		cowtest_destroy(copy, as);
+	}
+	else if (as != NULL) {
+		cowtest_switch(NULL);
+		as_destroy(as);
+	}
+
+	cowtest_switch(NULL);
+	kfree(ct_buf);
+	kprintf("copy-on-write test done\n");
+	return 0;
+}
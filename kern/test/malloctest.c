@@ -34,6 +34,7 @@
 #include <lib.h>
 #include <thread.h>
 #include <synch.h>
+#include <vm.h>
 #include <test.h>
 
 /*
@@ -138,3 +139,72 @@ mallocstress(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Test alloc_kpages/free_kpages; allocate runs of 1 to KPAGES_MAXRUN
+ * pages KPAGES_NTRIES times, filling each run with a pattern and
+ * checking it before freeing the previous one. Runs that are never
+ * given back would exhaust memory long before the end.
+ */
+
+#define KPAGES_NTRIES  2000
+#define KPAGES_MAXRUN  4
+
+static
+bool
+kpages_check(vaddr_t addr, unsigned npages, uint32_t tag)
+{
+	uint32_t *words = (uint32_t *)addr;
+	unsigned i;
+
+	for (i=0; i<npages*PAGE_SIZE/sizeof(uint32_t); i++) {
+		if (words[i] != (tag ^ i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int
+kpagestest(int nargs, char **args)
+{
+	vaddr_t addr, oldaddr = 0;
+	unsigned npages, oldnpages = 0;
+	uint32_t *words;
+	unsigned i;
+	int n;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting kernel page allocation test...\n");
+
+	for (n=0; n<KPAGES_NTRIES; n++) {
+		npages = n % KPAGES_MAXRUN + 1;
+		addr = alloc_kpages(npages);
+		if (addr == 0) {
+			kprintf("alloc_kpages(%u) failed after %d runs; "
+				"test failed.\n", npages, n);
+			break;
+		}
+		words = (uint32_t *)addr;
+		for (i=0; i<npages*PAGE_SIZE/sizeof(uint32_t); i++) {
+			words[i] = n ^ i;
+		}
+		if (oldaddr != 0) {
+			if (!kpages_check(oldaddr, oldnpages, n - 1)) {
+				kprintf("run %d was overwritten; test failed.\n",
+					n - 1);
+			}
+			free_kpages(oldaddr);
+		}
+		oldaddr = addr;
+		oldnpages = npages;
+	}
+	if (oldaddr != 0) {
+		free_kpages(oldaddr);
+	}
+
+	kprintf("kernel page allocation test done\n");
+	return 0;
+}
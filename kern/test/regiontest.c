@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Test code for the address space region table. Lays out segments the
+ * way load_elf would, including segments that share a page at their
+ * boundary, and checks the regions that result.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <test.h>
+
+#define RT_BASE 0x400000
+
+static const struct as_region rt_expect[] = {
+	/* read-only data ending inside the first page of text */
+	{ RT_BASE - PAGE_SIZE, RT_BASE, AR_READ, AR_TEXT, AR_ZEROFILL },
+	{ RT_BASE, RT_BASE + PAGE_SIZE, AR_READ|AR_EXEC, AR_TEXT,
+	  AR_ZEROFILL },
+	/* text ends and data starts on this page */
+	{ RT_BASE + PAGE_SIZE, RT_BASE + 2*PAGE_SIZE,
+	  AR_READ|AR_WRITE|AR_EXEC, AR_DATA, AR_ZEROFILL },
+	{ RT_BASE + 2*PAGE_SIZE, RT_BASE + 4*PAGE_SIZE, AR_READ|AR_WRITE,
+	  AR_DATA, AR_ZEROFILL },
+};
+#define RT_NEXPECT (sizeof(rt_expect) / sizeof(rt_expect[0]))
+
+static
+bool
+regiontest_check(struct addrspace *as, const char *what)
+{
+	const struct as_region *r;
+	unsigned i;
+
+	if (as->as_nregions != RT_NEXPECT) {
+		kprintf("%s: %u regions, expected %u; test failed.\n",
+			what, as->as_nregions, (unsigned)RT_NEXPECT);
+		return false;
+	}
+	for (i=0; i<RT_NEXPECT; i++) {
+		r = &as->as_regions[i];
+		if (r->ar_start != rt_expect[i].ar_start ||
+		    r->ar_end != rt_expect[i].ar_end ||
+		    r->ar_perm != rt_expect[i].ar_perm ||
+		    r->ar_kind != rt_expect[i].ar_kind) {
+			kprintf("%s: region %u is 0x%x-0x%x perm %u kind %u; "
+				"test failed.\n", what, i, r->ar_start,
+				r->ar_end, r->ar_perm, r->ar_kind);
+			return false;
+		}
+	}
+	return true;
+}
+
+int
+regiontest(int nargs, char **args)
+{
+	struct addrspace *as, *copy;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting region table test...\n");
+
+	as = as_create();
+	if (as == NULL) {
+		kprintf("as_create failed; test failed.\n");
+		return ENOMEM;
+	}
+
+	/* text, then data starting halfway into its last page */
+	result = as_define_region(as, RT_BASE, PAGE_SIZE + PAGE_SIZE/2,
+				  1, 0, 1);
+	if (result == 0) {
+		result = as_define_region(as, RT_BASE + PAGE_SIZE + PAGE_SIZE/2,
+					  2*PAGE_SIZE + PAGE_SIZE/2, 1, 1, 0);
+	}
+	/* read-only data below text, ending in its first page */
+	if (result == 0) {
+		result = as_define_region(as, RT_BASE - PAGE_SIZE/2,
+					  PAGE_SIZE, 1, 0, 0);
+	}
+	if (result) {
+		kprintf("as_define_region: %s; test failed.\n",
+			strerror(result));
+		as_destroy(as);
+		return result;
+	}
+
+	/* more than a boundary page */
+	result = as_define_region(as, RT_BASE + PAGE_SIZE, 2*PAGE_SIZE,
+				  1, 1, 0);
+	if (result != EINVAL) {
+		kprintf("overlapping region gave %d, not EINVAL; "
+			"test failed.\n", result);
+	}
+
+	if (regiontest_check(as, "as_define_region")) {
+		result = as_copy(as, &copy);
+		if (result) {
+			kprintf("as_copy: %s; test failed.\n",
+				strerror(result));
+		}
+		else {
+			regiontest_check(copy, "as_copy");
+			as_destroy(copy);
+		}
+	}
+
+	/* a segment with nothing in the file is all bss */
+	result = as_define_region(as, RT_BASE + 4*PAGE_SIZE, 2*PAGE_SIZE,
+				  1, 1, 0);
+	if (result == 0) {
+		result = as_define_file(as, RT_BASE + 4*PAGE_SIZE,
+					2*PAGE_SIZE, 0, NULL, 0);
+	}
+	if (result) {
+		kprintf("bss segment: %s; test failed.\n", strerror(result));
+	}
+	else if (as->as_nregions != RT_NEXPECT + 1 ||
+		 as->as_regions[RT_NEXPECT].ar_kind != AR_BSS ||
+		 as->as_regions[RT_NEXPECT].ar_backing != AR_ZEROFILL ||
+		 as->as_filemaps != NULL) {
+		kprintf("bss segment is kind %u backing %u; test failed.\n",
+			as->as_regions[as->as_nregions - 1].ar_kind,
+			as->as_regions[as->as_nregions - 1].ar_backing);
+	}
+	as_destroy(as);
+
+	kprintf("region table test done\n");
+	return 0;
+}
@@ -56,6 +56,8 @@
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 #define SCHEDULE_REF_BIT 10
 
+static int ref_bit_count = 0;		/* seconds since the last reset */
+
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
  */
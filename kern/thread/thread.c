@@ -184,6 +184,9 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	c->c_asid = 0;
+	c->c_asidgen = 0;
+	c->c_tlbnext = 0;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
@@ -191,6 +194,8 @@ cpu_create(unsigned hardware_number)
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_seq = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -227,6 +232,23 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Number of CPUs. CPU numbers (c_number) run from 0 to one less, so
+ * code keeping state per CPU can size its arrays with this once the
+ * secondary CPUs have been started.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+cpu_get(unsigned number)
+{
+	return cpuarray_get(&allcpus, number);
+}
+
 /*
  * Destroy a thread.
  *
@@ -655,7 +677,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/* Zero a page for the VM if it wants one, else sleep */
+			if (!vm_idle_zero()) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -1226,23 +1251,54 @@ ipi_broadcast(int code)
 void
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
-	int n;
+	ipi_tlbshootdown_many(target, mapping, 1);
+}
+
+/*
+ * Queue N shootdowns on TARGET and interrupt it once. If its queue
+ * overflows, it flushes its whole TLB instead.
+ */
+uint32_t
+ipi_tlbshootdown_many(struct cpu *target, const struct tlbshootdown *mappings,
+		      unsigned n)
+{
+	unsigned i;
+	int num;
+	uint32_t ticket;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
-	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		target->c_numshootdown = TLBSHOOTDOWN_ALL;
-	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+	for (i=0; i<n; i++) {
+		num = target->c_numshootdown;
+		if (num == TLBSHOOTDOWN_ALL) {
+			break;
+		}
+		if (num == TLBSHOOTDOWN_MAX) {
+			target->c_numshootdown = TLBSHOOTDOWN_ALL;
+			break;
+		}
+		target->c_shootdown[num] = mappings[i];
+		target->c_numshootdown = num+1;
 	}
+	ticket = ++target->c_shootdown_seq;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
+	return ticket;
+}
+
+void
+ipi_tlbshootdown_wait(struct cpu *target, uint32_t ticket)
+{
+	KASSERT(curthread->t_curspl == 0);
+	KASSERT(target != curcpu->c_self);
+
+	/* Signed difference, so the counters may wrap */
+	while ((int32_t)(target->c_shootdown_done - ticket) < 0) {
+		/* spin; the target answers as soon as it takes the IPI */
+	}
 }
 
 void
@@ -1285,6 +1341,7 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_done = curcpu->c_shootdown_seq;
 	}
 
 	curcpu->c_ipi_pending = 0;
@@ -1327,31 +1384,6 @@ void wchan_mywake(struct wchan *wc)
 	spinlock_release(&wc->wc_lock);
 }
 
-void update_pagetable(struct vm_manager_page_entry* page_entry)
-{
-	//kprintf("calling update_pagetable\n");
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	spinlock_acquire(&mybolt->wc_lock);	
-	struct threadlistnode * itervar;
-	struct thread * replaced_thread;
-	int curr_t_id;
-	struct page_table* page_t;
-	int totalpages;
-	struct page_table_entry* pt_pointer;
-	int j;
-	struct addrspace *as = page_entry->as;
-	page_t = &(as->as_pagetable);
-	totalpages = page_t->pt_totalpages;
-	pt_pointer = page_t->pt_entrytable;
-	for (j = 0 ; j < totalpages ; j++)
-	{
-		if (pt_pointer[j].paddress == page_entry->p_address) pt_pointer[j].vbit = false;
-	}
-
-	spinlock_release(&curcpu->c_runqueue_lock);
-	spinlock_release(&mybolt->wc_lock);
-}
-
 /*struct addrspace* get_thread(int id_thread)
 {
 	spinlock_acquire(&curcpu->c_runqueue_lock);
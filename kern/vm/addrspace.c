@@ -32,16 +32,72 @@
 #include <synch.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <addrspace.h>
 #include <thread.h>
+#include <cpu.h>
 #include <mips/tlb.h>
 #include <vm.h>
 #include <uio.h>
 #include <vfs.h>
 #include <spl.h>
 #include <vnode.h>
+#include <swap.h>
+#include <vmtlb.h>
+#include <wchan.h>
+#include <vmstat.h>
+#include <vmtrace.h>
 
 #define STACKPAGES 12
+
+int vm_replacement_policy = VM_POLICY_CLOCK;
+
+struct vm_manager *VM;
+
+/* Set once the coremap is up and kmalloc no longer steals pages */
+static volatile int vm_ready = 0;
+
+/* ram_stealmem, before vm_ready */
+static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Locking.
+ *
+ * coremap_lock covers the coremap, the free list, and the PTE of every
+ * resident page: a page can be evicted from any address space at any
+ * time, so its PTE only changes, and is only trusted, under this lock.
+ * It is a spinlock; nothing sleeps, allocates or does I/O holding it.
+ *
+ * Each address space's as_lock serializes faults and changes within
+ * it and covers its PTEs of pages that are not resident. Nobody holds
+ * it across I/O: a fault marks the page PTE_BUSY and waits on as_cv
+ * for anyone else faulting on it.
+ *
+ * A frame is in transit while it is being filled or evicted; its
+ * mappings are not usable and faults on it sleep until it is done.
+ * The pagedaemon marks frames busy while it writes them out, still
+ * mapped. Sleepers on a frame wait on one of frame_wchans, picked by
+ * frame number, with coremap_lock as the interlock.
+ *
+ * TLB entries of a frame are shot down under coremap_lock, but the
+ * wait for other CPUs to do so comes after it is released: a CPU
+ * spinning for the lock has interrupts off and would never answer.
+ * Until the wait is over the frame is neither written nor reused.
+ *
+ * Lock order: as_lock, then coremap_lock, then swap_lock and the TLB
+ * locks.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+#define FRAME_NWCHANS 16
+static struct wchan *frame_wchans[FRAME_NWCHANS];
+static struct wchan *pagedaemon_wchan;	/* pagedaemon sleeps here */
+
+static void pagedaemon_thread(void *data1, unsigned long data2);
+static void evict_frame(struct vm_manager_page_entry *page_entry,
+			struct vmtlb_batch *b);
+static int as_fill_page(struct addrspace *as, vaddr_t vaddr, paddr_t paddr,
+			pte_t pte, bool zeroed);
+static struct as_region *as_region_find(struct addrspace *as, vaddr_t vaddr);
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
  * assignment, this file is not compiled or linked or in any way
@@ -49,75 +105,123 @@
  */
 
 /*
- * OPT_DUMBVM is already unset. Demand paging is implement. Do read the given document first!!
- * Swap file is used for it. Pure paging is used. No segamenting is used.
+ * Select the page replacement policy by name. Returns EINVAL if the
+ * name is not known.
  */
-void stats_init(void)
+int
+vm_setpolicy(const char *name)
 {
-	VM_STATS->tlb_misses = 0;
-	VM_STATS->vm_fault_with_free_page = 0;
-	VM_STATS->vm_fault_with_lru = 0;
-	VM_STATS->page_fault = 0;
-	VM_STATS->tlb_misses_with_page_in_memory = 0;
+	if (!strcmp(name, "clock")) {
+		vm_replacement_policy = VM_POLICY_CLOCK;
+	}
+	else if (!strcmp(name, "refscan")) {
+		vm_replacement_policy = VM_POLICY_REFSCAN;
+	}
+	else {
+		return EINVAL;
+	}
+	return 0;
 }
 
-void print_stats(void)
+const char *
+vm_policyname(void)
 {
-	lock_acquire(vm_metrics_lock);
-	kprintf("Number of TLB misses are : %d\n",VM_STATS->tlb_misses);
-	kprintf("Number of TLB misses where page was found in memory : %d\n",VM_STATS->tlb_misses_with_page_in_memory);
-	kprintf("Number of page faults : %d\n",VM_STATS->page_fault);
-	kprintf("Number of page faults where free page was found : %d\n",VM_STATS->vm_fault_with_free_page);
-	kprintf("Number of page faults where LRU was used : %d\n",VM_STATS->vm_fault_with_lru);
-	lock_release(vm_metrics_lock);
+	return vm_replacement_policy == VM_POLICY_CLOCK ? "clock" : "refscan";
 }
 
-
 void
 vm_bootstrap(void)
 {
 	
-	uint32_t firstpaddr = 0; // address of first free physical page 
-	uint32_t lastpaddr = 0; // one past end of last free physical page
-	
-	vm_lock = lock_create("vm_lock");
-
-	vm_metrics_lock = lock_create("vm_metrics_lock");
+	paddr_t firstpaddr = 0; // address of first free physical page 
+	paddr_t lastpaddr = 0; // one past end of last free physical page
+	unsigned table_pages;
 	
-	lock_acquire(vm_lock);
 	VM = kmalloc(sizeof(struct vm_manager));
-	//kprintf("VM address is %x\n",VM);
-	VM->page_frame_table = kmalloc(sizeof(struct vm_manager_page_entry)*VM_PAGES);
-	//kprintf("VM address is %x\n",VM->page_frame_table);
-
-	VM_STATS = kmalloc(sizeof(struct vm_metrics));
-	stats_init();
 
-	firstpaddr = ram_stealmem(VM_PAGES);
-	lastpaddr = ram_stealmem(0);
+	/*
+	 * Take over all remaining RAM. The coremap goes at its start and
+	 * covers every frame after itself; it may describe a few more
+	 * frames than it needs to, which costs under one page.
+	 */
+	ram_getsize(&firstpaddr, &lastpaddr);
+	table_pages = DIVROUNDUP((lastpaddr - firstpaddr) / PAGE_SIZE *
+				 sizeof(struct vm_manager_page_entry),
+				 PAGE_SIZE);
+	VM->page_frame_table =
+		(struct vm_manager_page_entry *)PADDR_TO_KVADDR(firstpaddr);
+	firstpaddr += table_pages * PAGE_SIZE;
+	KASSERT(firstpaddr < lastpaddr);
 
 	uint32_t coremap_size = (lastpaddr - firstpaddr)/PAGE_SIZE;
-	kprintf("Virtual Memory: %d pages in memory\n", coremap_size);
+	kprintf("Virtual Memory: %d pages in memory, coremap %u pages\n",
+		coremap_size, table_pages);
 	kprintf("Virtual Memory: Page frames initialised : START : %0x END : %0x\n",PADDR_TO_KVADDR(firstpaddr),PADDR_TO_KVADDR(lastpaddr));
 
 	int num_pages = coremap_size;
 	int i;
 	VM->num_page_frames = num_pages;
-	for (i = 0 ; i < num_pages ; i++)
+	VM->first_paddr = firstpaddr;
+	VM->free_head = -1;
+	VM->zero_head = -1;
+	VM->num_free = 0;
+	VM->num_zeroed = 0;
+	VM->num_wired = 0;
+	VM->clock_hand = 0;
+	VM->readahead_window = VM_READAHEAD_INIT;
+	for (i = num_pages - 1 ; i >= 0 ; i--)
 	{
-		(VM->page_frame_table[i]).p_address = firstpaddr + i*PAGE_SIZE;
-		(VM->page_frame_table[i]).v_address = 0;
-		(VM->page_frame_table[i]).thread_id = -1;
-		(VM->page_frame_table[i]).is_free = true;
+		(VM->page_frame_table[i]).vpn = 0;
 		(VM->page_frame_table[i]).reference_bit = false;
 		(VM->page_frame_table[i]).dirty_bit = false;
-		(VM->page_frame_table[i]).valid_bit = false;
+		(VM->page_frame_table[i]).busy = false;
+		(VM->page_frame_table[i]).prefetched = false;
+		(VM->page_frame_table[i]).swap_index = SWAP_NOSLOT;
+		(VM->page_frame_table[i]).refcount = 0;
+		(VM->page_frame_table[i]).sharers = NULL;
+		(VM->page_frame_table[i]).wired = false;
+		(VM->page_frame_table[i]).zeroed = false;
+		/* push on the free list; lowest frame ends up first */
+		(VM->page_frame_table[i]).is_free = true;
+		(VM->page_frame_table[i]).prev_free = -1;
+		(VM->page_frame_table[i]).next_free = VM->free_head;
+		if (VM->free_head >= 0)
+			(VM->page_frame_table[VM->free_head]).prev_free = i;
+		VM->free_head = i;
+		VM->num_free++;
 	}
 
-	lock_release(vm_lock);
+	VM->low_water = VM_LOW_WATER(num_pages);
+	VM->high_water = VM_HIGH_WATER(num_pages);
+	KASSERT(VM->high_water <= num_pages);
+	/* about what the pagedaemon keeps free */
+	VM->zero_target = VM->high_water;
+	/*
+	 * The kernel may borrow frames as long as enough stay with user
+	 * pages for the pagedaemon to reach its high watermark.
+	 */
+	VM->max_wired = num_pages - VM->high_water - 1;
 
+	/* ram_stealmem is out of memory now; kmalloc must use the coremap */
 	vm_ready = 1;
-	
+
+	swap_bootstrap();
+
+	for (i = 0; i < FRAME_NWCHANS; i++) {
+		frame_wchans[i] = wchan_create("frame");
+		if (frame_wchans[i] == NULL) {
+			panic("Virtual Memory: cannot create frame wchans\n");
+		}
+	}
+	pagedaemon_wchan = wchan_create("pagedaemon");
+	if (pagedaemon_wchan == NULL) {
+		panic("Virtual Memory: cannot create pagedaemon wchan\n");
+	}
+	int result = thread_fork("pagedaemon", pagedaemon_thread, NULL, 0, NULL);
+	if (result) {
+		panic("Virtual Memory: cannot start pagedaemon: %s\n",
+		      strerror(result));
+	}
 }
 
 static
@@ -133,749 +237,2252 @@ getppages(unsigned long npages)
 }
 
 
+/*
+ * Find the coremap entry of a physical frame. Frames are contiguous
+ * from first_paddr, so this is just an index computation.
+ */
+static
+struct vm_manager_page_entry *
+coremap_entry(paddr_t paddr)
+{
+	unsigned index;
+
+	KASSERT(paddr >= VM->first_paddr);
+	index = (paddr - VM->first_paddr) / PAGE_SIZE;
+	if (index >= (unsigned)VM->num_page_frames) {
+		panic("Virtual Memory: frame %x not in coremap\n", paddr);
+	}
+	return &(VM->page_frame_table[index]);
+}
+
+/*
+ * Physical address of the frame an entry describes.
+ */
 static
 paddr_t
-getpage(unsigned long npages)
+coremap_paddr(struct vm_manager_page_entry *page_entry)
 {
-	/*implement it using vm manager*/
-	
-	struct vm_manager_page_entry* page_entry;
-	int i;
-	int totpages;
-	struct addrspace *as;
-	if (vm_ready)
-	{
-		//kprintf("Virtual Memory: getpage %ld\n", npages);
-		lock_acquire(vm_lock);
-		if (npages > 1)
-		{
-			panic("Virtual Memory: More than 1 pages required, cannot be allocated");
-		}
-		else
-		{
-			totpages = VM->num_page_frames;
-			for (i = 0 ; i < totpages ; i++)
-			{
-				page_entry = &(VM->page_frame_table[i]);
-				if (page_entry->is_free)
-				{
-					VM_STATS->vm_fault_with_free_page++;
-					lock_release(vm_lock);
-					return page_entry->p_address;
-				}
-				/* Free page found, physical address returned */
-			}
-			//kprintf("using lru\n");
-			VM_STATS->vm_fault_with_lru++;
-			/* No free page found, use page replacement (LRU) */
-			int id_thread;
-			for (i = 0 ; i < totpages ; i++)
-			{
-				page_entry = &(VM->page_frame_table[i]);
-				id_thread = page_entry->thread_id;
-				if (!page_entry->reference_bit)
-				{
-					if (page_entry->dirty_bit)
-					{
-						/* Write page to swap file of the process whose page is being replaced */
-						as = page_entry->as;
-						if(as==NULL) panic("process not found in run queue\n");
-						int result = write_page_to_swap(page_entry->p_address,page_entry->v_address,as);
-						if(result)
-							return result;
-						
-					}
+	return VM->first_paddr +
+		(paddr_t)(page_entry - VM->page_frame_table) * PAGE_SIZE;
+}
 
-					update_pagetable(page_entry);
-					
-					/* Make changes to page table of process whose page is being replaced */
-					
-					lock_release(vm_lock);
-					return page_entry->p_address;
-				}
-			}
+/*
+ * Read-ahead bookkeeping. A frame filled by read-ahead carries the
+ * prefetched flag until its page is first used. Each use widens the
+ * window by one page; each prefetched page that leaves memory unused
+ * halves it. Called with coremap_lock held.
+ */
+static
+void
+readahead_check_used(struct vm_manager_page_entry *page_entry)
+{
+	if (!page_entry->prefetched)
+		return;
+	page_entry->prefetched = false;
+	VMSTAT_INC(prefetch_hits);
+	if (VM->readahead_window < VM_READAHEAD_MAX)
+		VM->readahead_window++;
+}
 
-			/* All pages have reference bit as true. Returning a random page */
+static
+void
+readahead_check_wasted(struct vm_manager_page_entry *page_entry)
+{
+	if (!page_entry->prefetched)
+		return;
+	page_entry->prefetched = false;
+	VMSTAT_INC(prefetch_wasted);
+	if (VM->readahead_window > 1)
+		VM->readahead_window /= 2;
+}
 
-			page_entry = VM->page_frame_table;
-			id_thread = page_entry->thread_id;
-			if (page_entry->dirty_bit)
-			{
-				/* Write first page of physical memory of the process whose page is being replaced, to swap */
-				as = page_entry->as;;
-				if(as==NULL) panic("process not found in run queue\n");
-				int result = write_page_to_swap(page_entry->p_address,page_entry->v_address,as);
-				if(result)
-					return result;
-			}
-			
-			update_pagetable(page_entry);
-			/* Make changes to page table of process whose page is being replaced */
+/*
+ * Free list primitives. There are two lists: frames known to hold
+ * zeros, filled by idle CPUs, and all others. A frame's zeroed bit
+ * says which one it is on; a frame leaves either list with the bit
+ * clear. The lists are doubly linked so a frame can be taken from the
+ * middle when a contiguous run is allocated. Called with coremap_lock
+ * held.
+ */
+static
+void
+freelist_push(struct vm_manager_page_entry *page_entry)
+{
+	int index = page_entry - VM->page_frame_table;
+	int *head = page_entry->zeroed ? &VM->zero_head : &VM->free_head;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	page_entry->is_free = true;
+	page_entry->prev_free = -1;
+	page_entry->next_free = *head;
+	if (*head >= 0)
+		(VM->page_frame_table[*head]).prev_free = index;
+	*head = index;
+	VM->num_free++;
+	if (page_entry->zeroed)
+		VM->num_zeroed++;
+}
 
+static
+void
+freelist_remove(struct vm_manager_page_entry *page_entry)
+{
+	int *head = page_entry->zeroed ? &VM->zero_head : &VM->free_head;
 
-			lock_release(vm_lock);
-			return page_entry->p_address;
-		}
-		
-	}
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(page_entry->is_free);
+	if (page_entry->prev_free >= 0)
+		(VM->page_frame_table[page_entry->prev_free]).next_free =
+			page_entry->next_free;
 	else
-	{
-		return ram_stealmem(npages);
-	}
-	return 0;
+		*head = page_entry->next_free;
+	if (page_entry->next_free >= 0)
+		(VM->page_frame_table[page_entry->next_free]).prev_free =
+			page_entry->prev_free;
+	/* as and pte share storage with the links */
+	page_entry->as = NULL;
+	page_entry->pte = NULL;
+	page_entry->is_free = false;
+	VM->num_free--;
+	if (page_entry->zeroed)
+		VM->num_zeroed--;
+	page_entry->zeroed = false;
 }
 
-
-struct addrspace *
-as_create(void)
+/*
+ * The free frame to hand out next: a zeroed one if ZEROED and there
+ * is one, else preferably one that is not, so the pool is kept for
+ * those who want it. NULL if there are none.
+ */
+static
+struct vm_manager_page_entry *
+freelist_first(bool zeroed)
 {
-	//kprintf("Virtual Memory: as_create\n");
-	struct addrspace *as;
-	int i;
-	as = kmalloc(sizeof(struct addrspace));
-	//kprintf("%d\n",sizeof(struct addrspace));
-	if (as == NULL) {
-		return NULL;
-	}
+	int index;
 
-	/*
-	 * Initializing page table for the address space.
-	 */
-	as->as_stackpbase=0;
-	as->as_pagetable.pt_totalpages=0;
-	for(i=0;i<PAGE_TABLE_ENTRIES;i++)
-	{
-		as->as_pagetable.pt_entrytable[i].vbit=false;
-		as->as_pagetable.pt_entrytable[i].rbit=false;
-		as->as_pagetable.pt_entrytable[i].dbit=false;
-		as->as_pagetable.pt_entrytable[i].vaddress=0;
-		as->as_pagetable.pt_entrytable[i].paddress=0;
-	}
-	/*
-	 * Initializing swap file for the address space.
-	 */
-	as->as_sf.sf_file[0]='s';
-	as->as_sf.sf_file[1]='f';
-	as->as_sf.sf_file[2]= (char)((vaddr_t)as & 0x0000000f);
-	as->as_sf.sf_file[3]= (char)((vaddr_t)as & 0x000000f0);
-	as->as_sf.sf_file[4]= (char)((vaddr_t)as & 0x00000f00);
-	as->as_sf.sf_file[5]= (char)((vaddr_t)as & 0x0000f000);
-	as->as_sf.sf_file[6]= (char)((vaddr_t)as & 0x000f0000);
-	as->as_sf.sf_file[7]= (char)((vaddr_t)as & 0x00f00000);
-	as->as_sf.sf_file[8]= (char)((vaddr_t)as & 0x0f000000);
-	as->as_sf.sf_file[9]= (char)((vaddr_t)as & 0xf0000000);
-	as->as_sf.sf_pages = 0;
+	if (zeroed)
+		index = VM->zero_head >= 0 ? VM->zero_head : VM->free_head;
+	else
+		index = VM->free_head >= 0 ? VM->free_head : VM->zero_head;
+	if (index < 0)
+		return NULL;
+	return &(VM->page_frame_table[index]);
+}
 
-	return as;
+/*
+ * Forget the user page a frame held.
+ */
+static
+void
+coremap_clear(struct vm_manager_page_entry *page_entry)
+{
+	readahead_check_wasted(page_entry);
+	page_entry->vpn = 0;
+	page_entry->as = NULL;
+	page_entry->pte = NULL;
+	page_entry->reference_bit = false;
+	page_entry->dirty_bit = false;
+	KASSERT(page_entry->sharers == NULL);
+	page_entry->refcount = 0;
 }
 
 /*
- * This function is not tested but implemented just for the sake of completion.
+ * Put a user frame back on the free list. Called with coremap_lock
+ * held.
  */
+static
+void
+coremap_free(struct vm_manager_page_entry *page_entry)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(!page_entry->is_free);
+	KASSERT(!page_entry->wired && !page_entry->busy);
 
-int
-as_copy(struct addrspace *old, struct addrspace **ret)
+	coremap_clear(page_entry);
+	page_entry->transit = false;
+	freelist_push(page_entry);
+}
+
+/*
+ * Take a frame off the free list for a user page, or return NULL if
+ * it is empty. If ZEROED is not NULL, a pre-zeroed frame is taken if
+ * there is one and *ZEROED says whether it was. The frame comes back
+ * in transit; whoever fills it clears that. Called with coremap_lock
+ * held.
+ */
+static
+struct vm_manager_page_entry *
+coremap_alloc(bool *zeroed)
 {
-	//kprintf("Virtual Memory: as_copy\n");
-	struct addrspace *newas;
-	int i;
-	newas = as_create();
-	if (newas==NULL) {
-		return ENOMEM;
-	}
+	struct vm_manager_page_entry *page_entry;
 
-	newas->as_pagetable.pt_totalpages=old->as_pagetable.pt_totalpages;
-	for(i=0;i<newas->as_pagetable.pt_totalpages;i++)
-	{
-		newas->as_pagetable.pt_entrytable[i].vaddress=old->as_pagetable.pt_entrytable[i].vaddress;
-		if(old->as_pagetable.pt_entrytable[i].vbit)
-		{
-			newas->as_pagetable.pt_entrytable[i].paddress = getpage(1);
-			if (newas->as_pagetable.pt_entrytable[i].paddress == 0) {
-				return ENOMEM;
-			}
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
 
-			KASSERT(newas->as_pagetable.pt_entrytable[i].paddress != 0);
-			
-			newas->as_pagetable.pt_entrytable[i].vbit=true;
-			memmove((void *)PADDR_TO_KVADDR(newas->as_pagetable.pt_entrytable[i].paddress),
-			(const void *)PADDR_TO_KVADDR(old->as_pagetable.pt_entrytable[i].paddress),
-			PAGE_SIZE);
-		}
+	page_entry = freelist_first(zeroed != NULL);
+	if (page_entry == NULL) {
+		return NULL;
 	}
-	
-	newas->as_sf.sf_file[0]='s';
-	newas->as_sf.sf_file[1]='f';
-	newas->as_sf.sf_file[2]= (char)((vaddr_t)newas & 0x0000000f);
-	newas->as_sf.sf_file[3]= (char)((vaddr_t)newas & 0x000000f0);
-	newas->as_sf.sf_file[4]= (char)((vaddr_t)newas & 0x00000f00);
-	newas->as_sf.sf_file[5]= (char)((vaddr_t)newas & 0x0000f000);
-	newas->as_sf.sf_file[6]= (char)((vaddr_t)newas & 0x000f0000);
-	newas->as_sf.sf_file[7]= (char)((vaddr_t)newas & 0x00f00000);
-	newas->as_sf.sf_file[8]= (char)((vaddr_t)newas & 0x0f000000);
-	newas->as_sf.sf_file[9]= (char)((vaddr_t)newas & 0xf0000000);
-	newas->as_sf.sf_pages = old->as_sf.sf_pages ; 
-	for(i=0;i<newas->as_sf.sf_pages;i++)
-	{
-		newas->as_sf.sf_pagemapping[i].vaddress = old->as_sf.sf_pagemapping[i].vaddress;
-		newas->as_sf.sf_pagemapping[i].size = old->as_sf.sf_pagemapping[i].size;
-		newas->as_sf.sf_pagemapping[i].is_stack = old->as_sf.sf_pagemapping[i].is_stack;
+	if (zeroed != NULL) {
+		*zeroed = page_entry->zeroed;
 	}
-	
-	/*
-	*
-	*Copy swap file 
-	*
-	*/
-	struct vnode* vnode_ret;
-	int result = vfs_open(newas->as_sf.sf_file, 6, 0664, &vnode_ret);
-    if(result)
-    {
-        kprintf("error while opening file\n");
-        return result;
-    }
-    
-    vfs_close(vnode_ret);
-    
-	copy_swap_file(&(old->as_sf),&(newas->as_sf));
-		
-	*ret = newas;
-	return 0;
+	freelist_remove(page_entry);
+	page_entry->transit = true;
+	return page_entry;
+}
 
+/*
+ * Sleeping on a frame. frame_wait sleeps until the next frame_wakeup
+ * on the frame; the caller looks at the frame again afterwards, since
+ * the channel is shared with other frames. Called with coremap_lock
+ * held, which frame_wait drops while asleep.
+ */
+static
+struct wchan *
+frame_wchan(struct vm_manager_page_entry *page_entry)
+{
+	return frame_wchans[(page_entry - VM->page_frame_table) % FRAME_NWCHANS];
 }
 
+static
 void
-as_destroy(struct addrspace *as)
+frame_wait(struct vm_manager_page_entry *page_entry)
 {
-	//kprintf("Virtual Memory: as_destroy\n");
-	print_stats();
-	kfree(as);
+	struct wchan *wc = frame_wchan(page_entry);
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	wchan_lock(wc);
+	spinlock_release(&coremap_lock);
+	wchan_sleep(wc);
+	spinlock_acquire(&coremap_lock);
 }
 
+static
 void
-as_activate(struct addrspace *as)
+frame_wakeup(struct vm_manager_page_entry *page_entry)
 {
-	//kprintf("Virtual Memory: as_activate\n");
-	int i, spl;
-
-	(void)as;
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	wchan_wakeall(frame_wchan(page_entry));
+}
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
+/*
+ * Free a list of mapping nodes. kfree may give a page back to the
+ * coremap, so this is done after coremap_lock is released.
+ */
+static
+void
+mapping_free_list(struct vm_mapping *m)
+{
+	struct vm_mapping *next;
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	KASSERT(!spinlock_do_i_hold(&coremap_lock));
+	for (; m != NULL; m = next) {
+		next = m->next;
+		kfree(m);
 	}
+}
 
-	splx(spl);
+/*
+ * Put the nodes of list M in front of list TAIL.
+ */
+static
+struct vm_mapping *
+mapping_list_join(struct vm_mapping *m, struct vm_mapping *tail)
+{
+	struct vm_mapping *next;
 
+	for (; m != NULL; m = next) {
+		next = m->next;
+		m->next = tail;
+		tail = m;
+	}
+	return tail;
 }
 
 /*
- * Set up a segment at virtual address VADDR of size MEMSIZE. The
- * segment in memory extends from VADDR up to (but not including)
- * VADDR+MEMSIZE.
+ * Kernel page runs.
  *
- * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * alloc_kpages takes NPAGES physically contiguous frames from the
+ * coremap and marks them wired, so the replacement policies never
+ * pick them. The first entry of a run records its length for
+ * free_kpages. Wired frames are capped at max_wired.
+ *
+ *     kpages_take    - find NPAGES consecutive free frames, first fit,
+ *                      and wire them. Takes only coremap_lock, so it
+ *                      is safe from any context.
+ *     kpages_reclaim - if free frames are too scattered, find a window
+ *                      of free and evictable user frames and evict the
+ *                      user pages in it. Sleeps.
  */
-int
-as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
-		 int readable, int writeable, int executable)
+static
+void
+kpages_wire(struct vm_manager_page_entry *head, unsigned npages)
 {
-	//kprintf("Virtual Memory: as_define_region on vaddr: %x with size %d ",vaddr,sz);
-	int npages; 
-	int i,j;
-	vaddr_t vd = vaddr;
-	size_t memsize = sz;
-	/* Align the region. First, the base... */
-	sz += vd & ~(vaddr_t)PAGE_FRAME;
-	vd &= PAGE_FRAME;
-	/* ...and now the length. */
-	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+	unsigned i;
 
-	npages = sz / PAGE_SIZE;
-	//kprintf("and with pages %d\n",npages);
-	/* We don't use these - all pages are read-write */
-	(void)readable;
-	(void)writeable;
-	
-	KASSERT(as->as_pagetable.pt_totalpages+npages<PAGE_TABLE_ENTRIES);
-	KASSERT(as->as_pagetable.pt_totalpages == as->as_sf.sf_pages);
-	
-	/* 
-	 * set up the index for page table entry. Page table is index by virtual address
-	 * of the user address space.
-	 */
-		
-	for(i=as->as_pagetable.pt_totalpages;i<npages+as->as_pagetable.pt_totalpages;i++)
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	for (i = 0; i < npages; i++)
 	{
-		as->as_pagetable.pt_entrytable[i].vaddress=vd;
-		vd+=PAGE_SIZE;
+		/* Wired before it stops being free, so no policy sees it */
+		head[i].wired = true;
+		if (head[i].is_free)
+			freelist_remove(&head[i]);
 	}
-	as->as_pagetable.pt_totalpages+=npages;
-	
-	vd = vaddr & PAGE_FRAME;
-	
-	/*
-	 * set up swap file index. Each array index is the a offset(offset * PAGE_SIZE) in the 
-	 * swap file of the page starting at virtual address stored at that index.
-	 */
-	   
-	for(i=as->as_sf.sf_pages,j=1;i<as->as_sf.sf_pages+npages;i++,j++)
+	VM->num_wired += npages;
+}
+
+/*
+ * Record the run length, once no entry of the run holds a user page:
+ * kpages shares storage with the sharers list.
+ */
+static
+void
+kpages_setrun(struct vm_manager_page_entry *head, unsigned npages)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	for (i = 0; i < npages; i++)
 	{
-		if(j==1)
+		KASSERT(head[i].wired && head[i].as == NULL);
+		head[i].kpages = 0;
+	}
+	head->kpages = npages;
+	VMSTAT_ADD(kpages_coremap, npages);
+}
+
+static
+struct vm_manager_page_entry *
+kpages_take(unsigned npages)
+{
+	struct vm_manager_page_entry *head = NULL;
+	unsigned i, run;
+
+	spinlock_acquire(&coremap_lock);
+	if (VM->num_wired + (int)npages > VM->max_wired ||
+	    VM->num_free < (int)npages) {
+		spinlock_release(&coremap_lock);
+		return NULL;
+	}
+	if (npages == 1) {
+		head = freelist_first(false);
+	}
+	else {
+		run = 0;
+		for (i = 0; i < (unsigned)VM->num_page_frames; i++)
 		{
-			as->as_sf.sf_pagemapping[i].vaddress = vaddr; 
-			if(memsize+vaddr-vd <= PAGE_SIZE)
-				as->as_sf.sf_pagemapping[i].size = memsize;	
-			else
-				as->as_sf.sf_pagemapping[i].size = PAGE_SIZE+vd-vaddr;
-			
+			if (!(VM->page_frame_table[i]).is_free) {
+				run = 0;
+				continue;
+			}
+			if (++run == npages) {
+				head = &(VM->page_frame_table[i + 1 - npages]);
+				break;
+			}
 		}
-		else if(j==npages)
-		{
-			as->as_sf.sf_pagemapping[i].vaddress = vd;
-			as->as_sf.sf_pagemapping[i].size = memsize;	
+	}
+	if (head != NULL) {
+		kpages_wire(head, npages);
+		kpages_setrun(head, npages);
+	}
+	spinlock_release(&coremap_lock);
+	return head;
+}
+
+/*
+ * A frame kpages_reclaim may take: free, or holding a user page that
+ * can be evicted right now.
+ */
+static
+bool
+kpages_reclaimable(struct vm_manager_page_entry *page_entry)
+{
+	if (page_entry->is_free)
+		return true;
+	return !page_entry->wired && !page_entry->busy &&
+		!page_entry->transit && page_entry->refcount > 0;
+}
+
+static
+struct vm_manager_page_entry *
+kpages_reclaim(unsigned npages)
+{
+	struct vm_manager_page_entry *head = NULL;
+	struct vmtlb_batch batch;
+	unsigned i, run;
+
+	spinlock_acquire(&coremap_lock);
+	if (VM->num_wired + (int)npages > VM->max_wired) {
+		spinlock_release(&coremap_lock);
+		return NULL;
+	}
+	run = 0;
+	for (i = 0; i < (unsigned)VM->num_page_frames; i++)
+	{
+		if (!kpages_reclaimable(&(VM->page_frame_table[i]))) {
+			run = 0;
+			continue;
 		}
-		else
-		{
-			as->as_sf.sf_pagemapping[i].vaddress = vd;
-			as->as_sf.sf_pagemapping[i].size = PAGE_SIZE;
+		if (++run == npages) {
+			head = &(VM->page_frame_table[i + 1 - npages]);
+			break;
 		}
-		vd += PAGE_SIZE;
-		memsize-=as->as_sf.sf_pagemapping[i].size;
-		as->as_sf.sf_pagemapping[i].is_stack = false;
-		
 	}
-	as->as_sf.sf_pages+=npages;
-	(void)executable;
-	return 0;
+	if (head == NULL) {
+		spinlock_release(&coremap_lock);
+		return NULL;
+	}
+	kpages_wire(head, npages);
+	/* Wired, nobody else evicts them; in transit, nobody maps them */
+	for (i = 0; i < npages; i++)
+	{
+		if (head[i].as != NULL)
+			head[i].transit = true;
+	}
+	spinlock_release(&coremap_lock);
+
+	vmtlb_batch_init(&batch);
+	for (i = 0; i < npages; i++)
+	{
+		if (head[i].transit)
+			evict_frame(&head[i], &batch);
+	}
+
+	spinlock_acquire(&coremap_lock);
+	for (i = 0; i < npages; i++)
+	{
+		if (!head[i].transit)
+			continue;
+		coremap_clear(&head[i]);
+		head[i].transit = false;
+		VMSTAT_INC(kpages_reclaimed);
+	}
+	kpages_setrun(head, npages);
+	spinlock_release(&coremap_lock);
+	return head;
 }
-/* 
- * it does nothing as no page is loaded in memory due to demand paging. 
- * Just some set assertions.
+
+/*
+ * Whether alloc_kpages may sleep to evict pages: not in an interrupt
+ * handler, and not with interrupts off or a spinlock held.
+ */
+static
+bool
+kpages_maysleep(void)
+{
+	return curthread != NULL && !curthread->t_in_interrupt &&
+		curthread->t_curspl == 0;
+}
+
+/*
+ * Copy-on-write sharing. The first address space mapping a frame is
+ * its owner (as, vpn); every other one is on the sharers list, and
+ * refcount counts them all. Called with coremap_lock held.
+ *
+ *     frame_share - add a mapping of the frame by PTE, using the list
+ *                   node M.
+ *     frame_unmap - drop the mapping of AS at VADDR. If it was the
+ *                   owner, the first sharer takes its place. The frame
+ *                   is not freed; the caller does that once refcount
+ *                   reaches zero. Returns the list node given up, for
+ *                   the caller to kfree once it drops coremap_lock.
+ */
+static
+void
+frame_share(struct vm_manager_page_entry *page_entry, struct vm_mapping *m,
+	    struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(page_entry->refcount > 0);
+
+	m->as = as;
+	m->v_address = vaddr;
+	m->pte = pte;
+	KASSERT(page_entry->refcount < COREMAP_MAXREFS);
+	m->next = page_entry->sharers;
+	page_entry->sharers = m;
+	page_entry->refcount++;
+}
+
+static
+struct vm_mapping *
+frame_unmap(struct vm_manager_page_entry *page_entry, struct addrspace *as,
+	    vaddr_t vaddr)
+{
+	struct vm_mapping **mp, *m;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(page_entry->refcount > 0);
+
+	page_entry->refcount--;
+	if (page_entry->as == as && COREMAP_VADDR(page_entry) == vaddr)
+	{
+		m = page_entry->sharers;
+		if (m == NULL)
+		{
+			KASSERT(page_entry->refcount == 0);
+			return NULL;
+		}
+		page_entry->as = m->as;
+		page_entry->vpn = m->v_address >> 12;
+		page_entry->pte = m->pte;
+		page_entry->sharers = m->next;
+		m->next = NULL;
+		return m;
+	}
+	for (mp = &page_entry->sharers; *mp != NULL; mp = &(*mp)->next)
+	{
+		m = *mp;
+		if (m->as == as && m->v_address == vaddr)
+		{
+			*mp = m->next;
+			m->next = NULL;
+			return m;
+		}
+	}
+	panic("Virtual Memory: frame %x not mapped at %x\n",
+	      coremap_paddr(page_entry), vaddr);
+	return NULL;
+}
+
+/*
+ * Clear PTE_REF in every PTE mapping a frame. The UTLB refill handler
+ * only loads referenced pages, so the next miss on the page goes
+ * through vm_fault, which sets the bit again. Called with coremap_lock
+ * held.
+ */
+static
+void
+frame_clear_ref(struct vm_manager_page_entry *page_entry)
+{
+	struct vm_mapping *m;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	/* not mapped yet, or any more */
+	if (page_entry->refcount == 0)
+		return;
+
+	*page_entry->pte &= ~PTE_REF;
+	for (m = page_entry->sharers; m != NULL; m = m->next)
+		*m->pte &= ~PTE_REF;
+}
+
+/*
+ * Whether the replacement policies may take a frame: it holds a user
+ * page that nobody is filling, evicting or writing out.
+ */
+static
+bool
+frame_evictable(struct vm_manager_page_entry *page_entry)
+{
+	return !page_entry->is_free && !page_entry->wired &&
+		!page_entry->busy && !page_entry->transit &&
+		page_entry->refcount > 0;
+}
+
+/*
+ * Original replacement policy: take the first frame, scanning from
+ * frame 0, whose reference bit has not been set since the last
+ * reset_reference_bit(). If every frame is referenced, take the first
+ * one in use. Returns NULL if no frame can be taken right now.
+ * Called with coremap_lock held.
+ */
+static
+struct vm_manager_page_entry *
+choose_victim_refscan(void)
+{
+	struct vm_manager_page_entry *page_entry;
+	int i;
+
+	for (i = 0 ; i < VM->num_page_frames ; i++)
+	{
+		page_entry = &(VM->page_frame_table[i]);
+		if (!frame_evictable(page_entry))
+			continue;
+		if (!page_entry->reference_bit)
+			return page_entry;
+	}
+	for (i = 0 ; i < VM->num_page_frames ; i++)
+	{
+		page_entry = &(VM->page_frame_table[i]);
+		if (frame_evictable(page_entry))
+			return page_entry;
+	}
+	return NULL;
+}
+
+/*
+ * Clock (second chance) replacement. The hand keeps its position
+ * between calls; a referenced frame it passes over loses its
+ * reference bit and is taken on the next sweep if it has not been
+ * touched again. Its TLB entries are queued on B; nothing waits for
+ * them, as a late reference bit does no harm. Gives up, returning
+ * NULL, after two sweeps. Called with coremap_lock held.
+ */
+static
+struct vm_manager_page_entry *
+choose_victim_clock(struct vmtlb_batch *b)
+{
+	struct vm_manager_page_entry *page_entry;
+	int n;
+
+	for (n = 0; n < 2 * VM->num_page_frames; n++)
+	{
+		page_entry = &(VM->page_frame_table[VM->clock_hand]);
+		VM->clock_hand = (VM->clock_hand + 1) % VM->num_page_frames;
+		if (!frame_evictable(page_entry))
+			continue;
+		if (!page_entry->reference_bit)
+			return page_entry;
+		page_entry->reference_bit = false;
+		/* Drop the mapping so the next use faults and sets it again */
+		frame_clear_ref(page_entry);
+		vmtlb_batch_add(b, page_entry->as, COREMAP_VADDR(page_entry));
+	}
+	return NULL;
+}
+
+/*
+ * Give a frame whose page has never been written out a swap slot.
+ * Called with coremap_lock held.
+ */
+static
+void
+frame_ensure_slot(struct vm_manager_page_entry *page_entry)
+{
+	unsigned slot;
+
+	if (page_entry->swap_index != SWAP_NOSLOT)
+		return;
+	if (swap_alloc(&slot))
+		panic("Virtual Memory: out of swap space\n");
+	page_entry->swap_index = slot;
+}
+
+static
+struct vm_manager_page_entry *
+choose_victim(struct vmtlb_batch *b)
+{
+	if (vm_replacement_policy == VM_POLICY_CLOCK)
+		return choose_victim_clock(b);
+	return choose_victim_refscan();
+}
+
+/*
+ * Unmap an evicted frame from PTE. The page now lives only in its
+ * swap slot, or its file, or is zeros again.
+ */
+static
+void
+pte_evict(pte_t *pte, struct vm_manager_page_entry *page_entry)
+{
+	KASSERT(*pte & PTE_VALID);
+	KASSERT(PTE_PADDR(*pte) == coremap_paddr(page_entry));
+
+	if (page_entry->swap_index == SWAP_NOSLOT)
+		*pte = PTE_INUSE | (*pte & PTE_FILE);
+	else
+		*pte = PTE_MKSWAP(page_entry->swap_index) | PTE_INUSE
+			| PTE_SWAPPED | (*pte & (PTE_FILE|PTE_COW));
+}
+
+/*
+ * Eviction, in two steps around the write to swap, both called with
+ * coremap_lock held on a frame in transit.
+ *
+ *     evict_begin  - queue the frame's TLB entries for invalidation on
+ *                    B and give it a slot if it needs writing. Returns
+ *                    true if it does. The caller waits on B, outside
+ *                    the lock, before writing or reusing the frame.
+ *     evict_finish - unmap the frame from every address space using
+ *                    it. The frame's own reference to its slot passes
+ *                    to the owner's PTE; each sharer takes one more.
+ *                    Faults waiting on the frame are woken to find
+ *                    their page gone. Returns the sharers' list nodes,
+ *                    for mapping_free_list.
+ */
+static
+bool
+evict_begin(struct vm_manager_page_entry *page_entry, struct vmtlb_batch *b)
+{
+	struct vm_mapping *m;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(page_entry->transit && !page_entry->busy);
+	KASSERT(page_entry->as != NULL);
+
+	readahead_check_wasted(page_entry);
+	VMTRACE(VMTRACE_EVICT, false, page_entry->as,
+		COREMAP_VADDR(page_entry), page_entry - VM->page_frame_table);
+
+	/*
+	 * Clear the reference bits first, so the refill handler cannot
+	 * load the page again once it is gone from the TLB.
+	 */
+	frame_clear_ref(page_entry);
+	vmtlb_batch_add(b, page_entry->as, COREMAP_VADDR(page_entry));
+	for (m = page_entry->sharers; m != NULL; m = m->next)
+		vmtlb_batch_add(b, m->as, m->v_address);
+
+	if (!page_entry->dirty_bit)
+	{
+		/* Its slot already holds the same data, or it is still all zeros */
+		VMSTAT_INC(clean_evictions);
+		return false;
+	}
+	frame_ensure_slot(page_entry);
+	return true;
+}
+
+static
+struct vm_mapping *
+evict_finish(struct vm_manager_page_entry *page_entry)
+{
+	struct vm_mapping *m, *freelist;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	freelist = page_entry->sharers;
+	for (m = freelist; m != NULL; m = m->next)
+	{
+		if (page_entry->swap_index != SWAP_NOSLOT)
+			swap_dup(page_entry->swap_index);
+		pte_evict(m->pte, page_entry);
+	}
+	page_entry->sharers = NULL;
+	pte_evict(page_entry->pte, page_entry);
+	page_entry->pte = NULL;
+	page_entry->refcount = 0;
+	page_entry->dirty_bit = false;
+	frame_wakeup(page_entry);
+	return freelist;
+}
+
+/*
+ * Release coremap_lock to wait for the shootdowns on B and free the
+ * list nodes FREELIST, then free the N FRAMES, which evict_finish has
+ * unmapped and left in transit. Returns with coremap_lock held.
+ */
+static
+void
+evict_free(struct vm_manager_page_entry **frames, unsigned n,
+	   struct vm_mapping *freelist, struct vmtlb_batch *b)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	spinlock_release(&coremap_lock);
+	vmtlb_batch_wait(b);
+	mapping_free_list(freelist);
+	spinlock_acquire(&coremap_lock);
+
+	for (i = 0; i < n; i++)
+	{
+		KASSERT(frames[i]->transit);
+		coremap_free(frames[i]);
+		frame_wakeup(frames[i]);
+	}
+}
+
+/*
+ * Take a frame away from the page it holds. The page goes back to its
+ * swap slot, written out first if it is dirty. The caller has put the
+ * frame in transit, and it stays so. B is a batch for the shootdowns,
+ * which are waited for here. Called without coremap_lock; it is
+ * dropped for the write.
+ */
+static
+void
+evict_frame(struct vm_manager_page_entry *page_entry, struct vmtlb_batch *b)
+{
+	struct vm_mapping *freelist;
+	uint32_t start;
+	unsigned slot;
+	bool dirty;
+
+	start = getcycles();
+	spinlock_acquire(&coremap_lock);
+	dirty = evict_begin(page_entry, b);
+	slot = page_entry->swap_index;
+	spinlock_release(&coremap_lock);
+	vmtlb_batch_wait(b);
+
+	if (dirty)
+	{
+		/* Write page to the swap slot of the process whose page is being replaced */
+		int result = write_page_to_swap(coremap_paddr(page_entry), slot);
+		if(result)
+			panic("Virtual Memory: pageout failed: %s\n", strerror(result));
+	}
+
+	/* Make changes to page table of process whose page is being replaced */
+	spinlock_acquire(&coremap_lock);
+	freelist = evict_finish(page_entry);
+	spinlock_release(&coremap_lock);
+	mapping_free_list(freelist);
+	vmstat_latency(VMLAT_EVICT, start);
+}
+
+/*
+ * Pageout daemon.
+ *
+ * getpage wakes it when the free list drops below the low watermark.
+ * It then takes frames from the replacement policy until the free list
+ * is back up to the high watermark. A dirty frame is written out while
+ * still mapped and marked busy meanwhile; it is freed only if it is
+ * still clean afterwards. Faults normally find a free frame and never
+ * wait for a write.
+ */
+/*
+ * Write out a cluster of dirty frames. The pages are made clean and
+ * their mappings dropped first, so a store during the write faults and
+ * dirties the page again. If their slots are not already consecutive,
+ * the pages are moved to a fresh run of slots so the whole cluster
+ * goes out in one transfer. Frames still clean afterwards are freed.
+ * B carries the shootdowns. Called with coremap_lock held, which is
+ * dropped for the write.
+ */
+static
+void
+pageout_cluster(struct vm_manager_page_entry **cluster, unsigned npages,
+		struct vmtlb_batch *b)
+{
+	struct vm_manager_page_entry *freed[SWAP_MAXCLUSTER];
+	paddr_t paddrs[SWAP_MAXCLUSTER];
+	unsigned slots[SWAP_MAXCLUSTER];
+	struct vm_mapping *freelist;
+	unsigned i, nfreed, slot;
+	bool contiguous;
+	int result;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(npages > 0 && npages <= SWAP_MAXCLUSTER);
+
+	for (i = 0; i < npages; i++)
+	{
+		KASSERT(*cluster[i]->pte & PTE_VALID);
+		paddrs[i] = coremap_paddr(cluster[i]);
+
+		*cluster[i]->pte &= ~PTE_DIRTY;
+		cluster[i]->dirty_bit = false;
+		cluster[i]->busy = true;
+		vmtlb_batch_add(b, cluster[i]->as, COREMAP_VADDR(cluster[i]));
+	}
+
+	for (i = 0; i < npages; i++)
+	{
+		if (cluster[i]->swap_index == SWAP_NOSLOT ||
+		    cluster[i]->swap_index != cluster[0]->swap_index + i)
+			break;
+	}
+	if (i < npages && swap_alloc_run(npages, &slot) == 0)
+	{
+		/* Resident pages keep their slot in the coremap only */
+		for (i = 0; i < npages; i++)
+		{
+			if (cluster[i]->swap_index != SWAP_NOSLOT)
+				swap_free(cluster[i]->swap_index);
+			cluster[i]->swap_index = slot + i;
+		}
+	}
+	contiguous = (i == npages);
+	for (i = 0; i < npages; i++)
+	{
+		if (!contiguous)
+			frame_ensure_slot(cluster[i]);
+		slots[i] = cluster[i]->swap_index;
+	}
+
+	spinlock_release(&coremap_lock);
+	/* no CPU may store to the pages while they are written */
+	vmtlb_batch_wait(b);
+	if (contiguous)
+	{
+		result = write_pages_to_swap(paddrs, npages, slots[0]);
+	}
+	else
+	{
+		/* no run of free slots; one transfer per page */
+		result = 0;
+		for (i = 0; i < npages && result == 0; i++)
+			result = write_page_to_swap(paddrs[i], slots[i]);
+	}
+	if (result)
+		kprintf("pagedaemon: pageout failed: %s\n", strerror(result));
+	spinlock_acquire(&coremap_lock);
+
+	VMSTAT_ADD(pagedaemon_cleaned, npages);
+	VMSTAT_INC(pageout_clusters);
+
+	freelist = NULL;
+	nfreed = 0;
+	for (i = 0; i < npages; i++)
+	{
+		cluster[i]->busy = false;
+		if (result)
+		{
+			/* a shared frame stays read-only; the coremap knows */
+			if ((*cluster[i]->pte & PTE_COW) == 0)
+				*cluster[i]->pte |= PTE_DIRTY;
+			cluster[i]->dirty_bit = true;
+		}
+		else if (!cluster[i]->dirty_bit)
+		{
+			cluster[i]->transit = true;
+			evict_begin(cluster[i], b);
+			freelist = mapping_list_join(evict_finish(cluster[i]),
+						     freelist);
+			freed[nfreed++] = cluster[i];
+			VMSTAT_INC(pagedaemon_freed);
+		}
+		/* else written to again while we were at it */
+		frame_wakeup(cluster[i]);
+	}
+
+	evict_free(freed, nfreed, freelist, b);
+}
+
+static
+void
+pagedaemon_thread(void *data1, unsigned long data2)
+{
+	struct vm_manager_page_entry *cluster[SWAP_MAXCLUSTER];
+	struct vm_manager_page_entry *clean[SWAP_MAXCLUSTER];
+	struct vm_manager_page_entry *page_entry;
+	struct vm_mapping *freelist;
+	struct vmtlb_batch batch;
+	unsigned n, nclean;
+
+	(void)data1;
+	(void)data2;
+
+	spinlock_acquire(&coremap_lock);
+	while (1)
+	{
+		while (VM->num_free >= VM->low_water)
+		{
+			wchan_lock(pagedaemon_wchan);
+			spinlock_release(&coremap_lock);
+			wchan_sleep(pagedaemon_wchan);
+			spinlock_acquire(&coremap_lock);
+		}
+		VMSTAT_INC(pagedaemon_wakeups);
+
+		while (VM->num_free < VM->high_water)
+		{
+			/*
+			 * Unmap clean victims and free them together once
+			 * their shootdowns are done; gather dirty ones into
+			 * a cluster. Gathered frames are marked busy so the
+			 * policy does not hand them out twice.
+			 */
+			vmtlb_batch_init(&batch);
+			freelist = NULL;
+			n = 0;
+			nclean = 0;
+			while (VM->num_free + (int)(n + nclean) < VM->high_water &&
+			       n < SWAP_MAXCLUSTER && nclean < SWAP_MAXCLUSTER)
+			{
+				page_entry = choose_victim(&batch);
+				if (page_entry == NULL)
+					break;
+				if (!page_entry->dirty_bit)
+				{
+					page_entry->transit = true;
+					evict_begin(page_entry, &batch);
+					freelist = mapping_list_join(
+						evict_finish(page_entry), freelist);
+					clean[nclean++] = page_entry;
+					VMSTAT_INC(pagedaemon_freed);
+					continue;
+				}
+				page_entry->busy = true;
+				cluster[n++] = page_entry;
+			}
+			if (nclean > 0)
+			{
+				evict_free(clean, nclean, freelist, &batch);
+			}
+			if (n > 0)
+			{
+				pageout_cluster(cluster, n, &batch);
+			}
+			else if (nclean == 0)
+			{
+				vmtlb_batch_send(&batch);
+				/* everything is in use by faults; let them finish */
+				spinlock_release(&coremap_lock);
+				thread_yield();
+				spinlock_acquire(&coremap_lock);
+			}
+		}
+	}
+}
+
+/*
+ * Get a frame for a user page, in transit: nobody else uses it until
+ * the caller has filled it and hands it to update_page_frame_entry,
+ * or gives it back with coremap_free. Takes a free frame if there is
+ * one, else evicts one here. A caller that will zero the frame passes
+ * ZEROED: it gets a pre-zeroed frame if there is one, and *ZEROED
+ * says whether it did.
+ */
+static
+paddr_t
+getpage(unsigned long npages, bool *zeroed)
+{
+	struct vm_manager_page_entry* page_entry;
+	struct vmtlb_batch batch;
+
+	/* User frames come one at a time; kernel runs use alloc_kpages */
+	KASSERT(npages == 1);
+	KASSERT(vm_ready);
+
+	vmtlb_batch_init(&batch);
+
+	spinlock_acquire(&coremap_lock);
+	while (1)
+	{
+		page_entry = coremap_alloc(zeroed);
+		if (VM->num_free < VM->low_water)
+			wchan_wakeone(pagedaemon_wchan);
+		if (page_entry != NULL)
+		{
+			/* Free page found, physical address returned */
+			VMSTAT_INC(vm_fault_with_free_page);
+			if (zeroed != NULL && *zeroed)
+				VMSTAT_INC(zero_pool_hits);
+			else if (zeroed != NULL)
+				VMSTAT_INC(zero_pool_misses);
+			spinlock_release(&coremap_lock);
+			return coremap_paddr(page_entry);
+		}
+		/* No free page found and pagedaemon behind: replace one here */
+		page_entry = choose_victim(&batch);
+		if (page_entry != NULL)
+			break;
+		/* every frame is on its way somewhere; try again shortly */
+		vmtlb_batch_send(&batch);
+		spinlock_release(&coremap_lock);
+		thread_yield();
+		spinlock_acquire(&coremap_lock);
+	}
+	VMSTAT_INC(vm_fault_with_lru);
+	page_entry->transit = true;
+	spinlock_release(&coremap_lock);
+
+	evict_frame(page_entry, &batch);
+
+	spinlock_acquire(&coremap_lock);
+	coremap_clear(page_entry);
+	if (zeroed != NULL)
+	{
+		*zeroed = false;
+		VMSTAT_INC(zero_pool_misses);
+	}
+	spinlock_release(&coremap_lock);
+	return coremap_paddr(page_entry);
+}
+
+/*
+ * Evict the page of AS at VADDR and free its frame, as getpage does
+ * with the victim it chooses. Returns EINVAL if the page is not in
+ * memory, or EBUSY if its frame cannot be taken right now.
+ */
+int
+as_evict_page(struct addrspace *as, vaddr_t vaddr)
+{
+	struct vm_manager_page_entry *page_entry;
+	struct vmtlb_batch batch;
+	pte_t *pte;
+
+	vmtlb_batch_init(&batch);
+	spinlock_acquire(&coremap_lock);
+	pte = pt_lookup(&as->as_pagetable, vaddr & PAGE_FRAME);
+	if (pte == NULL || (*pte & PTE_VALID) == 0)
+	{
+		spinlock_release(&coremap_lock);
+		return EINVAL;
+	}
+	page_entry = coremap_entry(PTE_PADDR(*pte));
+	if (!frame_evictable(page_entry))
+	{
+		spinlock_release(&coremap_lock);
+		return EBUSY;
+	}
+	page_entry->transit = true;
+	spinlock_release(&coremap_lock);
+
+	evict_frame(page_entry, &batch);
+
+	spinlock_acquire(&coremap_lock);
+	coremap_free(page_entry);
+	frame_wakeup(page_entry);
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+/*
+ * Idle CPUs keep up to zero_target free frames zeroed, so demand-zero
+ * faults need not. The frame is off the free lists while it is zeroed,
+ * so nobody else can take it meanwhile.
+ */
+bool
+vm_idle_zero(void)
+{
+	struct vm_manager_page_entry *page_entry;
+
+	if (!vm_ready)
+		return false;
+
+	spinlock_acquire(&coremap_lock);
+	if (VM->num_zeroed >= VM->zero_target || VM->free_head < 0)
+	{
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	page_entry = &(VM->page_frame_table[VM->free_head]);
+	freelist_remove(page_entry);
+	spinlock_release(&coremap_lock);
+
+	/* a wakeup that comes in meanwhile is seen when we return */
+	cpu_irqon();
+	bzero((void *)PADDR_TO_KVADDR(coremap_paddr(page_entry)), PAGE_SIZE);
+	cpu_irqoff();
+
+	spinlock_acquire(&coremap_lock);
+	page_entry->zeroed = true;
+	freelist_push(page_entry);
+	VMSTAT_INC(zero_pool_filled);
+	spinlock_release(&coremap_lock);
+	return true;
+}
+
+
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as;
+	as = kmalloc(sizeof(struct addrspace));
+	if (as == NULL) {
+		return NULL;
+	}
+
+	as->as_lock = lock_create("as_lock");
+	if (as->as_lock == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_cv = cv_create("as_cv");
+	if (as->as_cv == NULL) {
+		lock_destroy(as->as_lock);
+		kfree(as);
+		return NULL;
+	}
+
+	/*
+	 * Initializing page table for the address space. Directory and
+	 * leaves are allocated as regions get defined.
+	 */
+	as->as_stackpbase=0;
+	pt_init(&as->as_pagetable);
+	as->as_filemaps = NULL;
+	as->as_regions = NULL;
+	as->as_nregions = 0;
+	as->as_maxregions = 0;
+	as->as_asid = 0;
+	as->as_asidgen = 0;
+	as->as_cpus = 0;
+
+	return as;
+}
+
+/*
+ * Copy OLD for fork. There is no fork in this tree yet; the callers
+ * are the vm1 test, on an address space with no pages in memory, and
+ * the vm2 test, which writes through both copies afterwards.
+ *
+ * What it relies on:
+ *   - the caller holds no spinlock, as it waits for TLB shootdowns;
+ *   - threads of OLD may fault meanwhile: its as_lock is held
+ *     throughout, and pages marked PTE_BUSY are waited for;
+ *   - each resident frame is shared through the coremap (refcount and
+ *     sharers list, under coremap_lock) and each swapped page through
+ *     swap_dup. Both copies get PTE_COW and are mapped read-only until
+ *     cow_fault makes one private, except in text regions: those are
+ *     never written, so their pages are just shared and the parent's
+ *     TLB entries for them need no shootdown;
+ *   - NEWAS is seen by nobody else until it is returned.
+ */
+
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *newas;
+	struct vm_manager_page_entry *page_entry;
+	struct vm_mapping *sharer;
+	pte_t *oldpte, *newpte;
+	vaddr_t va;
+	struct as_filemap *fm, *newfm;
+	struct as_region *region;
+	struct vmtlb_batch batch;
+	bool text;
+	int d, l;
+	newas = as_create();
+	if (newas==NULL) {
+		return ENOMEM;
+	}
+
+	if (old->as_nregions > 0)
+	{
+		newas->as_regions =
+			kmalloc(old->as_nregions * sizeof(struct as_region));
+		if (newas->as_regions == NULL) {
+			as_destroy(newas);
+			return ENOMEM;
+		}
+		memcpy(newas->as_regions, old->as_regions,
+		       old->as_nregions * sizeof(struct as_region));
+		newas->as_nregions = old->as_nregions;
+		newas->as_maxregions = old->as_nregions;
+	}
+
+	/* File mappings are shared; the list order does not matter */
+	for (fm = old->as_filemaps; fm != NULL; fm = fm->fm_next)
+	{
+		newfm = kmalloc(sizeof(struct as_filemap));
+		if (newfm == NULL) {
+			as_destroy(newas);
+			return ENOMEM;
+		}
+		*newfm = *fm;
+		VOP_INCREF(newfm->fm_vnode);
+		newfm->fm_next = newas->as_filemaps;
+		newas->as_filemaps = newfm;
+	}
+
+	/* Other threads of the old process may be faulting meanwhile */
+	vmtlb_batch_init(&batch);
+	lock_acquire(old->as_lock);
+	if (old->as_pagetable.pt_dir != NULL)
+	{
+		for(d=0;d<PT_DIRENTRIES;d++)
+		{
+			if(old->as_pagetable.pt_dir[d] == NULL)
+				continue;
+			for(l=0;l<PT_LEAFENTRIES;l++)
+			{
+				oldpte = &old->as_pagetable.pt_dir[d][l];
+				while(*oldpte & PTE_BUSY)
+					cv_wait(old->as_cv, old->as_lock);
+				if((*oldpte & PTE_INUSE) == 0)
+					continue;
+				va = PT_VADDR(d, l);
+				newpte = pt_define(&newas->as_pagetable, va);
+				if (newpte == NULL) {
+					vmtlb_batch_wait(&batch);
+					lock_release(old->as_lock);
+					as_destroy(newas);
+					return ENOMEM;
+				}
+				if((*oldpte & (PTE_VALID|PTE_SWAPPED)) == 0)
+				{
+					/* demand-zero or file page; nothing to copy yet */
+					*newpte = *oldpte;
+					continue;
+				}
+				sharer = kmalloc(sizeof(struct vm_mapping));
+				if (sharer == NULL) {
+					vmtlb_batch_wait(&batch);
+					lock_release(old->as_lock);
+					as_destroy(newas);
+					return ENOMEM;
+				}
+
+				/* text is never written, so it needs no copy */
+				region = as_region_find(old, va);
+				text = region != NULL && region->ar_kind == AR_TEXT;
+
+				/*
+				 * Share the frame or the slot; both copies become
+				 * read-only until one of them writes. Look again
+				 * under coremap_lock, since the page may have been
+				 * evicted meanwhile, and let an eviction under way
+				 * finish first.
+				 */
+				spinlock_acquire(&coremap_lock);
+				while(*oldpte & PTE_VALID)
+				{
+					page_entry = coremap_entry(PTE_PADDR(*oldpte));
+					if (!page_entry->transit)
+						break;
+					frame_wait(page_entry);
+				}
+				if((*oldpte & PTE_VALID) && text)
+				{
+					frame_share(page_entry, sharer, newas, va, newpte);
+					sharer = NULL;
+				}
+				else if(*oldpte & PTE_VALID)
+				{
+					frame_share(page_entry, sharer, newas, va, newpte);
+					sharer = NULL;
+					*oldpte = (*oldpte & ~PTE_DIRTY) | PTE_COW;
+					/* a TLB may still let the parent write it */
+					vmtlb_batch_add(&batch, old, va);
+					VMSTAT_INC(cow_shared);
+				}
+				else if(*oldpte & PTE_SWAPPED)
+				{
+					swap_dup(PTE_SWAPINDEX(*oldpte));
+					if (!text)
+					{
+						*oldpte |= PTE_COW;
+						VMSTAT_INC(cow_shared);
+					}
+				}
+				*newpte = *oldpte;
+				spinlock_release(&coremap_lock);
+
+				if (sharer != NULL)
+					kfree(sharer);
+			}
+		}
+	}
+	/*
+	 * Other CPUs running the parent may hold writable mappings of
+	 * what is now shared. They are gone once this returns; any
+	 * loaded since, by a fault or the refill handler, saw PTE_COW
+	 * and are read-only.
+	 */
+	vmtlb_batch_wait(&batch);
+	lock_release(old->as_lock);
+
+	*ret = newas;
+	return 0;
+
+}
+
+void
+as_destroy(struct addrspace *as)
+{
+	struct vm_manager_page_entry *page_entry;
+	struct vm_mapping *m;
+	struct as_filemap *fm;
+	pte_t *pte;
+	int d, l;
+
+	VMTRACE(VMTRACE_EXIT, false, as, 0, -1);
+
+	/*
+	 * Give back every resident frame and every swap slot. A frame
+	 * that is being evicted or written out is waited for; once it is
+	 * gone, the PTE says where the page went.
+	 */
+	if (as->as_pagetable.pt_dir != NULL) {
+		for (d=0; d<PT_DIRENTRIES; d++) {
+			if (as->as_pagetable.pt_dir[d] == NULL)
+				continue;
+			for (l=0; l<PT_LEAFENTRIES; l++) {
+				pte = &as->as_pagetable.pt_dir[d][l];
+				if ((*pte & PTE_INUSE) == 0)
+					continue;
+				KASSERT((*pte & PTE_BUSY) == 0);
+				m = NULL;
+				spinlock_acquire(&coremap_lock);
+				while (*pte & PTE_VALID) {
+					page_entry = coremap_entry(PTE_PADDR(*pte));
+					if (!page_entry->busy && !page_entry->transit)
+						break;
+					frame_wait(page_entry);
+				}
+				if (*pte & PTE_VALID) {
+					/* a frame shared after fork stays with the others */
+					m = frame_unmap(page_entry, as, PT_VADDR(d, l));
+					if (page_entry->refcount == 0) {
+						if (page_entry->swap_index != SWAP_NOSLOT)
+							swap_free(page_entry->swap_index);
+						coremap_free(page_entry);
+					}
+				}
+				else if (*pte & PTE_SWAPPED) {
+					swap_free(PTE_SWAPINDEX(*pte));
+				}
+				*pte = 0;
+				spinlock_release(&coremap_lock);
+				mapping_free_list(m);
+			}
+		}
+	}
+
+	/*
+	 * Our translations may stay in the TLBs: our ASID is not handed
+	 * out again before they are flushed at the next generation. But
+	 * the refill handler must stop walking the directory we free.
+	 */
+	vmtlb_deactivate(as);
+	pt_destroy(&as->as_pagetable);
+
+	while (as->as_filemaps != NULL) {
+		fm = as->as_filemaps;
+		as->as_filemaps = fm->fm_next;
+		VOP_DECREF(fm->fm_vnode);
+		kfree(fm);
+	}
+	kfree(as->as_regions);
+	cv_destroy(as->as_cv);
+	lock_destroy(as->as_lock);
+	kfree(as);
+}
+
+void
+as_activate(struct addrspace *as)
+{
+	vmtlb_activate(as);
+}
+
+/*
+ * Region table. The table is a sorted array, grown by doubling; an
+ * address space has a handful of regions. Changed only while a program
+ * is loaded, before anyone can fault on it.
+ *
+ *     as_region_index  - the index of the first region ending above
+ *                        VADDR, or as_nregions if there is none.
+ *     as_region_find   - the region holding VADDR, or NULL.
+ *     as_region_insert - put R at index I.
+ *     as_region_share  - give page VA, the first or last page of
+ *                        region I, a region of its own that also has
+ *                        PERM: the page is shared with a segment next
+ *                        to it.
+ */
+#define AS_REGIONS_INIT 4
+
+static
+unsigned
+as_region_index(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned lo, hi, mid;
+
+	lo = 0;
+	hi = as->as_nregions;
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (as->as_regions[mid].ar_end <= vaddr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static
+struct as_region *
+as_region_find(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned i;
+
+	i = as_region_index(as, vaddr);
+	if (i == as->as_nregions || as->as_regions[i].ar_start > vaddr)
+		return NULL;
+	return &as->as_regions[i];
+}
+
+static
+int
+as_region_insert(struct addrspace *as, unsigned i, const struct as_region *r)
+{
+	struct as_region *t;
+	unsigned max;
+
+	KASSERT(i <= as->as_nregions);
+
+	if (as->as_nregions == as->as_maxregions)
+	{
+		max = as->as_maxregions == 0 ? AS_REGIONS_INIT
+			: 2 * as->as_maxregions;
+		t = kmalloc(max * sizeof(struct as_region));
+		if (t == NULL) {
+			return ENOMEM;
+		}
+		if (as->as_regions != NULL) {
+			memcpy(t, as->as_regions,
+			       as->as_nregions * sizeof(struct as_region));
+			kfree(as->as_regions);
+		}
+		as->as_regions = t;
+		as->as_maxregions = max;
+	}
+	memmove(&as->as_regions[i + 1], &as->as_regions[i],
+		(as->as_nregions - i) * sizeof(struct as_region));
+	as->as_regions[i] = *r;
+	as->as_nregions++;
+	return 0;
+}
+
+static
+int
+as_region_share(struct addrspace *as, unsigned i, vaddr_t va, unsigned perm)
+{
+	struct as_region r;
+	int result;
+
+	r = as->as_regions[i];
+	KASSERT(va == r.ar_start || va + PAGE_SIZE == r.ar_end);
+	if ((r.ar_perm | perm) == r.ar_perm)
+		return 0;
+
+	r.ar_perm |= perm;
+	/* data on the page has to stay writable */
+	if (r.ar_perm & AR_WRITE)
+		r.ar_kind = AR_DATA;
+	if (r.ar_end - r.ar_start == PAGE_SIZE)
+	{
+		as->as_regions[i] = r;
+		return 0;
+	}
+
+	r.ar_start = va;
+	r.ar_end = va + PAGE_SIZE;
+	if (va == as->as_regions[i].ar_start)
+	{
+		result = as_region_insert(as, i, &r);
+		if (result)
+			return result;
+		as->as_regions[i + 1].ar_start += PAGE_SIZE;
+	}
+	else
+	{
+		result = as_region_insert(as, i + 1, &r);
+		if (result)
+			return result;
+		as->as_regions[i].ar_end -= PAGE_SIZE;
+	}
+	return 0;
+}
+
+/*
+ * Define the pages of a region of KIND with permissions PERM.
+ */
+static
+int
+as_define_pages(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		unsigned perm, unsigned kind)
+{
+	struct as_region r;
+	int npages;
+	int i, first, last;
+	unsigned index;
+	int result;
+	pte_t *pte;
+	vaddr_t vd = vaddr;
+	/* Align the region. First, the base... */
+	sz += vd & ~(vaddr_t)PAGE_FRAME;
+	vd &= PAGE_FRAME;
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = sz / PAGE_SIZE;
+	
+	if (vd >= USERSPACETOP || sz > USERSPACETOP - vd) {
+		return EFAULT;
+	}
+
+	/*
+	 * Adjacent ELF segments may share a page at their boundary. Such
+	 * a page may be the last one of the region below us or the first
+	 * one of the region above us; any other overlap is an error.
+	 */
+	r.ar_start = vd;
+	r.ar_end = vd + sz;
+	first = last = -1;
+	index = as_region_index(as, r.ar_start);
+	if (index < as->as_nregions &&
+	    as->as_regions[index].ar_start < r.ar_start) {
+		if (as->as_regions[index].ar_end != r.ar_start + PAGE_SIZE) {
+			return EINVAL;
+		}
+		first = index;
+		r.ar_start += PAGE_SIZE;
+	}
+	if (r.ar_start < r.ar_end) {
+		index = as_region_index(as, r.ar_start);
+		if (index < as->as_nregions &&
+		    as->as_regions[index].ar_start < r.ar_end) {
+			if (as->as_regions[index].ar_start !=
+			    r.ar_end - PAGE_SIZE) {
+				return EINVAL;
+			}
+			last = index;
+			r.ar_end -= PAGE_SIZE;
+		}
+	}
+	
+	/* 
+	 * Define a PTE for every page of the region. New pages are
+	 * demand-zero: they get a frame on first touch and a swap slot
+	 * only when first evicted dirty. load_segment gives slots to the
+	 * pages that hold file data.
+	 */
+	
+	r.ar_perm = perm;
+	r.ar_kind = kind;
+	r.ar_backing = AR_ZEROFILL;
+	for(i=0;i<npages;i++)
+	{
+		pte = pt_define(&as->as_pagetable, vd);
+		if (pte == NULL) {
+			return ENOMEM;
+		}
+		vd+=PAGE_SIZE;
+	}
+
+	/* the upper one first, so the index of the lower one holds */
+	if (last >= 0) {
+		result = as_region_share(as, last, r.ar_end, perm);
+		if (result) {
+			return result;
+		}
+	}
+	if (first >= 0) {
+		result = as_region_share(as, first, r.ar_start - PAGE_SIZE,
+					 perm);
+		if (result) {
+			return result;
+		}
+	}
+	if (r.ar_start >= r.ar_end) {
+		/* nothing but shared pages */
+		return 0;
+	}
+	return as_region_insert(as, as_region_index(as, r.ar_start), &r);
+}
+
+/*
+ * Set up a segment at virtual address VADDR of size MEMSIZE. The
+ * segment in memory extends from VADDR up to (but not including)
+ * VADDR+MEMSIZE.
+ *
+ * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
+ * write, or execute permission should be set on the segment. Stores
+ * to a segment that is not writeable fault; the others are kept for
+ * the record, as the TLB cannot refuse reads or execution.
+ */
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable)
+{
+	unsigned perm = 0;
+
+	if (readable)
+		perm |= AR_READ;
+	if (writeable)
+		perm |= AR_WRITE;
+	if (executable)
+		perm |= AR_EXEC;
+	return as_define_pages(as, vaddr, sz, perm,
+			       writeable ? AR_DATA : AR_TEXT);
+}
+/*
+ * Back the first FILESIZE bytes of the segment of MEMSIZE bytes at
+ * VADDR, already defined, with the contents of V at OFFSET. Nothing
+ * is read now. FILESIZE may be 0, for a segment that is all bss.
+ */
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, size_t memsize,
+	       size_t filesize, struct vnode *v, off_t offset)
+{
+	struct as_filemap *fm;
+	struct as_region *r, tail;
+	unsigned i;
+	pte_t *pte;
+	vaddr_t va, fileend, memend;
+	int result;
+
+	KASSERT(filesize <= memsize);
+	KASSERT(as_region_find(as, vaddr) != NULL);
+
+	/*
+	 * The segment may cover more than one region, if it shares a page
+	 * with the one below or above. Whole pages past the file are bss,
+	 * unless another segment has file data on them.
+	 */
+	if (filesize == 0)
+		fileend = vaddr & PAGE_FRAME;
+	else
+		fileend = (vaddr + filesize + PAGE_SIZE - 1) & PAGE_FRAME;
+	memend = (vaddr + memsize + PAGE_SIZE - 1) & PAGE_FRAME;
+	for (i = as_region_index(as, vaddr);
+	     i < as->as_nregions && as->as_regions[i].ar_start < memend; i++)
+	{
+		r = &as->as_regions[i];
+		if (r->ar_start >= fileend)
+		{
+			if (r->ar_kind == AR_DATA && r->ar_backing == AR_ZEROFILL)
+				r->ar_kind = AR_BSS;
+			continue;
+		}
+		if (r->ar_end > fileend)
+		{
+			tail = *r;
+			tail.ar_start = fileend;
+			if (tail.ar_kind == AR_DATA)
+				tail.ar_kind = AR_BSS;
+			result = as_region_insert(as, i + 1, &tail);
+			if (result) {
+				return result;
+			}
+			r = &as->as_regions[i];
+			r->ar_end = fileend;
+		}
+		/* a page shared with another segment's bss may be marked so */
+		if (r->ar_kind == AR_BSS)
+			r->ar_kind = AR_DATA;
+		r->ar_backing = AR_FILEBACKED;
+	}
+
+	if (filesize == 0)
+		return 0;
+
+	fm = kmalloc(sizeof(struct as_filemap));
+	if (fm == NULL) {
+		return ENOMEM;
+	}
+	fm->fm_vaddr = vaddr;
+	fm->fm_filesize = filesize;
+	fm->fm_offset = offset;
+	fm->fm_vnode = v;
+	VOP_INCREF(v);
+	fm->fm_next = as->as_filemaps;
+	as->as_filemaps = fm;
+
+	for (va = vaddr & PAGE_FRAME; va < vaddr + filesize; va += PAGE_SIZE)
+	{
+		pte = pt_lookup(&as->as_pagetable, va);
+		KASSERT(pte != NULL && (*pte & PTE_INUSE));
+		*pte |= PTE_FILE;
+	}
+	return 0;
+}
+
+/*
+ * Initial contents of the page at VADDR, whose PTE is PTE, into the
+ * frame PADDR: zeros, overlaid with the bytes of every file mapping
+ * that covers part of the page. ZEROED says the frame holds zeros
+ * already.
+ */
+static
+int
+as_fill_page(struct addrspace *as, vaddr_t vaddr, paddr_t paddr, pte_t pte,
+	     bool zeroed)
+{
+	struct as_filemap *fm;
+	struct iovec iov;
+	struct uio u;
+	vaddr_t lo, hi;
+	char *kbuf = (char *)PADDR_TO_KVADDR(paddr);
+	int result;
+
+	if (!zeroed) {
+		bzero(kbuf, PAGE_SIZE);
+	}
+	if ((pte & PTE_FILE) == 0) {
+		VMSTAT_INC(zero_fills);
+		return 0;
+	}
+
+	for (fm = as->as_filemaps; fm != NULL; fm = fm->fm_next)
+	{
+		lo = vaddr > fm->fm_vaddr ? vaddr : fm->fm_vaddr;
+		hi = vaddr + PAGE_SIZE;
+		if (hi > fm->fm_vaddr + fm->fm_filesize)
+			hi = fm->fm_vaddr + fm->fm_filesize;
+		if (lo >= hi)
+			continue;
+
+		uio_kinit(&iov, &u, kbuf + (lo - vaddr), hi - lo,
+			  fm->fm_offset + (lo - fm->fm_vaddr), UIO_READ);
+		result = VOP_READ(fm->fm_vnode, &u);
+		if (result) {
+			return result;
+		}
+		if (u.uio_resid != 0) {
+			return EIO;
+		}
+	}
+
+	VMSTAT_INC(file_fills);
+	return 0;
+}
+
+/* 
+ * it does nothing as no page is loaded in memory due to demand paging. 
+ * Just some set assertions.
+ */
+
+int
+as_prepare_load(struct addrspace *as)
+{
+	KASSERT(as->as_stackpbase == 0);
+	
+	return 0;
+}
+
+int
+as_complete_load(struct addrspace *as)
+{
+	/*
+	 * Write this.
+	 */
+
+	(void)as;
+	return 0;
+}
+
+/*
+ * stack grows from higher address to lower
+ */
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+	int result;
+	
+	/* stack pages are demand-zero */
+	result = as_define_pages(as, USERSTACK - STACKPAGES * PAGE_SIZE,
+				 STACKPAGES * PAGE_SIZE, AR_READ|AR_WRITE,
+				 AR_STACK);
+	if (result) {
+		return result;
+	}
+	
+	/* Initial user-level stack pointer */
+	*stackptr = USERSTACK;
+	
+	return 0;
+}
+
+/*
+ * brings in the page from its swap slot to main memory pointed by paddr
+ */
+ 
+int
+read_page_from_swap(paddr_t paddr, unsigned swapindex)
+{
+	uint32_t start;
+	int result;
+
+	start = getcycles();
+	result = swap_read((void *)PADDR_TO_KVADDR(paddr), swapindex);
+	vmstat_latency(VMLAT_PAGEIN, start);
+	VMSTAT_INC(page_ins);
+
+	return result;
+}
+
+/*
+ * brings in NPAGES pages from consecutive swap slots starting at
+ * SWAPINDEX into the frames PADDRS[], in one transfer
+ */
+
+int
+read_pages_from_swap(paddr_t *paddrs, unsigned npages, unsigned swapindex)
+{
+	void *kbufs[SWAP_MAXCLUSTER];
+	uint32_t start;
+	unsigned i;
+	int result;
+
+	KASSERT(npages <= SWAP_MAXCLUSTER);
+	for (i=0; i<npages; i++) {
+		kbufs[i] = (void *)PADDR_TO_KVADDR(paddrs[i]);
+	}
+
+	start = getcycles();
+	result = swap_readv(kbufs, npages, swapindex);
+	vmstat_latency(VMLAT_PAGEIN, start);
+	VMSTAT_ADD(page_ins, npages);
+
+	return result;
+}
+
+/*
+ * writes back the NPAGES frames PADDRS[] to consecutive swap slots
+ * starting at SWAPINDEX, in one transfer
  */
 
 int
-as_prepare_load(struct addrspace *as)
+write_pages_to_swap(paddr_t *paddrs, unsigned npages, unsigned swapindex)
 {
-	//kprintf("Virtual Memory: as_prepare_load\n");
-	int i;
-	
-	for(i=0;i<as->as_pagetable.pt_totalpages;i++)
-	{
-		KASSERT(as->as_pagetable.pt_entrytable[i].paddress==0);
-	}
-	KASSERT(as->as_stackpbase == 0);
-	
-	/*kprintf("printing addr space\n");
-	for(i=0;i<as->as_pagetable.pt_totalpages;i++)
-	{
-		kprintf("%x\n",as->as_pagetable.pt_entrytable[i].vaddress);
+	void *kbufs[SWAP_MAXCLUSTER];
+	uint32_t start;
+	unsigned i;
+	int result;
+
+	KASSERT(npages <= SWAP_MAXCLUSTER);
+	for (i=0; i<npages; i++) {
+		kbufs[i] = (void *)PADDR_TO_KVADDR(paddrs[i]);
 	}
-	
-	kprintf("printing swap space\n");
-	for(i=0;i<as->as_sf.sf_pages;i++)
-	{
-		kprintf("%x %d\n",as->as_sf.sf_pagemapping[i].vaddress,as->as_sf.sf_pagemapping[i].size);
-	}*/
-	
-	return 0;
+
+	start = getcycles();
+	result = swap_writev(kbufs, npages, swapindex);
+	vmstat_latency(VMLAT_PAGEOUT, start);
+	VMSTAT_ADD(page_outs, npages);
+
+	return result;
 }
 
+/*
+ * writes back the page from main memory pointed by paddr to its swap slot
+ */
+
 int
-as_complete_load(struct addrspace *as)
+write_page_to_swap(paddr_t paddr, unsigned swapindex)
 {
-	/*
-	 * Write this.
-	 */
+	uint32_t start;
+	int result;
 
-	(void)as;
-	return 0;
+	start = getcycles();
+	result = swap_write((void *)PADDR_TO_KVADDR(paddr), swapindex);
+	vmstat_latency(VMLAT_PAGEOUT, start);
+	VMSTAT_INC(page_outs);
+
+	return result;
 }
 
 /*
- * stack grows from higher address to lower
+ * Hand a frame filled by a fault to the page it now holds: the owner
+ * is AS at VADDR_FAULT, whose PTE already maps it. The frame leaves
+ * transit, and anyone waiting for it is woken. Called with
+ * coremap_lock held.
  */
-int
-as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+int update_page_frame_entry(vaddr_t vaddr_fault, paddr_t paddr_fault, bool dbit, struct addrspace* as, unsigned swapindex)
 {
-	
-	
-	int i,j;
-	
-	for (i = as->as_pagetable.pt_totalpages,j=1; i < STACKPAGES + as->as_pagetable.pt_totalpages;j++, i++)
-	{
-		as->as_pagetable.pt_entrytable[i].vaddress = USERSTACK - j * PAGE_SIZE;
-	}
-	as->as_pagetable.pt_totalpages+=STACKPAGES;
-	
-	for(i=as->as_sf.sf_pages,j=1;i<as->as_sf.sf_pages+STACKPAGES;i++,j++)
-	{
-		as->as_sf.sf_pagemapping[i].vaddress = USERSTACK - j * PAGE_SIZE;
-		as->as_sf.sf_pagemapping[i].size = PAGE_SIZE;
-		as->as_sf.sf_pagemapping[i].is_stack = true;
-	}
-	as->as_sf.sf_pages+=STACKPAGES;
-	
-	/*
-	 * filling up the stack pages of swap file with zeros
-	 */
-	
-	void * ktemp = kmalloc(PAGE_SIZE);
-	struct iovec sfiov;
-	struct uio sfu;
-	struct vnode * sfv;
-	off_t sfoffset = as->as_sf.sf_pages - STACKPAGES;
-	int result;
-	result = vfs_open(as->as_sf.sf_file, 2, 0664, &sfv);
-	if (result) {
-		return result;
-	}
-	for(i =0;i<STACKPAGES;i++)
-	{
-		bzero(ktemp, PAGE_SIZE);
-		sfiov.iov_ubase = ktemp;
-		sfiov.iov_len = PAGE_SIZE;
-		sfu.uio_iov = &sfiov;
-		sfu.uio_iovcnt = 1;
-		sfu.uio_resid = PAGE_SIZE;
-		sfu.uio_offset = sfoffset*PAGE_SIZE;
-		sfu.uio_segflg = UIO_SYSSPACE;
-		sfu.uio_rw = UIO_WRITE;
-		sfu.uio_space = NULL;
-	}
-	kfree(ktemp);
-	/* Initial user-level stack pointer */
-	*stackptr = USERSTACK;
-	//kprintf("Virtual Memory: as_define_stack : stack : %x\n",*stackptr);
-	
+	struct vm_manager_page_entry* page_frame_entry;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	page_frame_entry = coremap_entry(paddr_fault);
+	KASSERT(!page_frame_entry->is_free && page_frame_entry->transit);
+	KASSERT(page_frame_entry->refcount == 0);
+
+	page_frame_entry->vpn = vaddr_fault >> 12;
+	page_frame_entry->as = as;
+	page_frame_entry->pte = pt_lookup(&as->as_pagetable, vaddr_fault);
+	KASSERT(page_frame_entry->pte != NULL);
+	KASSERT(PTE_PADDR(*page_frame_entry->pte) == paddr_fault);
+	page_frame_entry->dirty_bit = dbit;
+	page_frame_entry->reference_bit = true;
+	page_frame_entry->swap_index = swapindex;
+	page_frame_entry->refcount = 1;
+	page_frame_entry->transit = false;
+	frame_wakeup(page_frame_entry);
 	return 0;
 }
 
 /*
- * brings in the page from swap file to main memory pointed by paddr
+ * Pick the pages to read ahead of a major fault at VADDR, whose slot
+ * is SWAPINDEX: the following pages of the address space that are out
+ * on swap in the following slots, up to the read-ahead window. Each
+ * gets a frame from the free list; read-ahead never evicts, and stops
+ * at the pagedaemon's low watermark. The PTEs are marked PTE_BUSY
+ * until readahead_install. Returns the number of pages, with their
+ * frames in PADDRS[]. Called with the as_lock held.
  */
- 
-int
-read_page_from_swap(paddr_t paddr, vaddr_t vaddr, struct addrspace *as)
+static
+unsigned
+readahead_reserve(struct addrspace *as, vaddr_t vaddr, unsigned swapindex,
+		  paddr_t *paddrs)
 {
-	//kprintf("Virtual Memory: read_page_from_swap : vaddr : %x to paddr : %x\n",vaddr,paddr);
-	struct vnode *v;
-	struct iovec iov;
-	struct uio u;
-	int i,result;
-	off_t offset=-1;
-	vaddr_t load_vaddr;
-	size_t load_size;
-	bool load_is_stack;
-	struct swap_file* sf = &(as->as_sf);
-	/* Open the file. */
-	result = vfs_open(sf->sf_file, 0, 0664, &v);
-	if (result) {
-		return result;
-	}
-	
-	for(i=0;i<sf->sf_pages;i++)
+	struct vm_manager_page_entry *page_entry;
+	pte_t *pte;
+	unsigned n;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	spinlock_acquire(&coremap_lock);
+	for (n = 0; n < (unsigned)VM->readahead_window; n++)
 	{
-		if((sf->sf_pagemapping[i].vaddress & PAGE_FRAME) == (vaddr & PAGE_FRAME))
-		{
-			 offset = i;
-			 load_vaddr =  sf->sf_pagemapping[i].vaddress;
-			 load_size = sf->sf_pagemapping[i].size;
-			 load_is_stack = sf->sf_pagemapping[i].is_stack;
-			 break;
-		}
-	}
-	KASSERT(offset!=-1);
-	
-	iov.iov_ubase = (void*)PADDR_TO_KVADDR(paddr);
-	iov.iov_len = load_size;
-	u.uio_iov = &iov;
-	u.uio_iovcnt = 1;
-	u.uio_resid = load_size;
-	u.uio_offset = offset*PAGE_SIZE;
-	u.uio_segflg = UIO_SYSSPACE;
-	u.uio_rw = UIO_READ;
-	u.uio_space = NULL;
-
-	result = VOP_READ(v, &u);
-	if (result) {
-		return result;
+		vaddr += PAGE_SIZE;
+		if (vaddr >= USERSPACETOP)
+			break;
+		pte = pt_lookup(&as->as_pagetable, vaddr);
+		if (pte == NULL ||
+		    (*pte & (PTE_INUSE|PTE_VALID|PTE_SWAPPED|PTE_BUSY))
+		    != (PTE_INUSE|PTE_SWAPPED))
+			break;
+		if (PTE_SWAPINDEX(*pte) != swapindex + n + 1)
+			break;
+		if (VM->num_free <= VM->low_water)
+			break;
+		page_entry = coremap_alloc(NULL);
+		KASSERT(page_entry != NULL);
+		paddrs[n] = coremap_paddr(page_entry);
+		*pte |= PTE_BUSY;
 	}
-	vfs_close(v);
-	/*
-	if((vaddr & PAGE_FRAME) == 0x400000){
-	int k;
-	kprintf("printing segment\n");
-	for(k=0;k<sf->sf_pagemapping[i].size;k++)
-		kprintf("%d ",(int)*((char*)(PADDR_TO_KVADDR(paddr)+k)));
-	kprintf("\nend printing segment\n");
-	}
-	*/
-	return 0;
+	spinlock_release(&coremap_lock);
+	return n;
 }
 
 /*
- * writes back the page from swap file to main memory pointed by paddr
+ * Map the pages brought in by read-ahead. They go in clean and
+ * unreferenced, so the replacement policy takes them first if they
+ * turn out not to be needed. If the read failed, the frames are given
+ * back instead. Called with the as_lock held.
  */
-
-int
-write_page_to_swap(paddr_t paddr, vaddr_t vaddr, struct addrspace *as)
+static
+void
+readahead_install(struct addrspace *as, vaddr_t vaddr, unsigned swapindex,
+		  paddr_t *paddrs, unsigned npages, bool failed)
 {
-	//kprintf("Virtual Memory: write_page_to_swap : vaddr : %x to paddr : %x\n",vaddr,paddr);
-	struct vnode *v;
-	struct iovec iov;
-	struct uio u;
-	int i,result;
-	off_t offset;
-	vaddr_t load_vaddr;
-	size_t load_size;
-	bool load_is_stack;
-	struct swap_file* sf = &(as->as_sf);
-	/*int k;
-	kprintf("printing segment\n");
-	for(k=0;k<sf->sf_pagemapping[i].size;k++)
-		kprintf("%d ",(int)*((char*)(PADDR_TO_KVADDR(paddr)+k)));
-	kprintf("\nend printing segment\n");
-	*/
-	/* Open the file. */
-	result = vfs_open(sf->sf_file, 1, 0664, &v);
-	if (result) {
-		return result;
-	}
-	
-	for(i=0;i<sf->sf_pages;i++)
+	struct vm_manager_page_entry *page_entry;
+	pte_t *pte;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	spinlock_acquire(&coremap_lock);
+	for (i = 0; i < npages; i++)
 	{
-		if((sf->sf_pagemapping[i].vaddress & PAGE_FRAME) == (vaddr & PAGE_FRAME))
+		vaddr += PAGE_SIZE;
+		pte = pt_lookup(&as->as_pagetable, vaddr);
+		KASSERT(pte != NULL && (*pte & PTE_BUSY));
+		page_entry = coremap_entry(paddrs[i]);
+		if (failed)
 		{
-			 offset = i;
-			 load_vaddr =  sf->sf_pagemapping[i].vaddress;
-			 load_size = sf->sf_pagemapping[i].size;
-			 load_is_stack = sf->sf_pagemapping[i].is_stack;
-			 break;
+			*pte &= ~PTE_BUSY;
+			coremap_free(page_entry);
+			continue;
 		}
+		*pte = paddrs[i] | PTE_INUSE | PTE_SWAPPED | PTE_VALID
+			| (*pte & (PTE_FILE|PTE_COW));
+
+		page_entry->vpn = vaddr >> 12;
+		page_entry->dirty_bit = false;
+		page_entry->reference_bit = false;
+		page_entry->as = as;
+		page_entry->pte = pte;
+		page_entry->swap_index = swapindex + i + 1;
+		page_entry->prefetched = true;
+		page_entry->refcount = 1;
+		page_entry->transit = false;
+		frame_wakeup(page_entry);
 	}
-	KASSERT(offset!=-1);
-	iov.iov_ubase = (void*)PADDR_TO_KVADDR(paddr);
-	iov.iov_len = load_size;
-	u.uio_iov = &iov;
-	u.uio_iovcnt = 1;
-	u.uio_resid = load_size;
-	u.uio_offset = offset*PAGE_SIZE;
-	u.uio_segflg = UIO_SYSSPACE;
-	u.uio_rw = UIO_WRITE;
-	u.uio_space = NULL;
-
-	result = VOP_WRITE(v, &u);
-	if (result) {
-		return result;
-	}
-	vfs_close(v);
-	
-	return 0;
+	if (!failed)
+		VMSTAT_ADD(prefetch_issued, npages);
+	spinlock_release(&coremap_lock);
 }
 
-/* 
- * not tested
+/*
+ * First write to a COW page at VADDR, now resident in *PADDRP. If
+ * another address space still maps the frame, give this one a private
+ * copy; otherwise take the frame over, dropping its slot if that is
+ * still shared so the next pageout does not overwrite it. Returns
+ * false if the page left memory meanwhile and the fault has to be
+ * handled again. Called with the as_lock held. It is dropped while a
+ * frame for the copy is found, as getpage may write a victim out; the
+ * PTE is marked PTE_BUSY meanwhile, as in vm_pagein.
  */
-int copy_swap_file(struct swap_file* from, struct swap_file* to)
+static
+bool
+cow_fault(struct addrspace *as, vaddr_t vaddr, pte_t *pte, paddr_t *paddrp)
 {
-	struct vnode *vfrom, *vto;
-	struct iovec iovfrom, iovto;
-	struct uio ufrom,uto;
-	int i,result;
-	
-	/* Open the file. */
-	result = vfs_open(from->sf_file, 0, 0664, &vfrom);
-	if (result) {
-		return result;
-	}
-	result = vfs_open(to->sf_file, 1, 0664, &vto);
-	if (result) {
-		return result;
-	}
-	void *buf = kmalloc(PAGE_SIZE);
-	for(i=0;i<from->sf_pages;i++)
+	struct vm_manager_page_entry *page_entry;
+	struct vm_mapping *m;
+	struct vmtlb_batch batch;
+	paddr_t newpaddr = 0;
+
+	spinlock_acquire(&coremap_lock);
+	page_entry = coremap_entry(*paddrp);
+	while (1)
 	{
-		uio_kinit(&iovfrom, &ufrom, (void*)buf, from->sf_pagemapping[i].size, i*PAGE_SIZE, UIO_READ);
-		result = VOP_READ(vfrom, &ufrom);
-		if (result) {
-			return result;
+		/* pagedaemon, or another sharer, may be using the frame */
+		while (page_entry->busy || page_entry->transit)
+			frame_wait(page_entry);
+
+		if ((*pte & PTE_VALID) == 0 || PTE_PADDR(*pte) != *paddrp)
+		{
+			if (newpaddr != 0)
+				coremap_free(coremap_entry(newpaddr));
+			spinlock_release(&coremap_lock);
+			return false;
 		}
-		
-		uio_kinit(&iovto, &uto, (void*)buf, from->sf_pagemapping[i].size, i*PAGE_SIZE, UIO_WRITE);
-		result = VOP_WRITE(vto, &uto);
-		if (result) {
-			return result;
+		if (page_entry->refcount == 1)
+		{
+			if (newpaddr != 0)
+				coremap_free(coremap_entry(newpaddr));
+			if (page_entry->swap_index != SWAP_NOSLOT &&
+			    swap_shared(page_entry->swap_index))
+			{
+				swap_free(page_entry->swap_index);
+				page_entry->swap_index = SWAP_NOSLOT;
+				*pte &= ~PTE_SWAPPED;
+			}
+			*pte = (*pte & ~PTE_COW) | PTE_DIRTY;
+			page_entry->dirty_bit = true;
+			VMSTAT_INC(cow_reuses);
+			spinlock_release(&coremap_lock);
+			return true;
 		}
+		if (newpaddr != 0)
+			break;
+
+		/*
+		 * Keep the frame from being evicted, and other threads of AS
+		 * off the page, while we find another.
+		 */
+		page_entry->transit = true;
+		*pte |= PTE_BUSY;
+		spinlock_release(&coremap_lock);
+		lock_release(as->as_lock);
+
+		newpaddr = getpage(1, NULL);
+
+		lock_acquire(as->as_lock);
+		spinlock_acquire(&coremap_lock);
+		KASSERT(*pte & PTE_BUSY);
+		KASSERT(PTE_PADDR(*pte) == *paddrp);
+		*pte &= ~PTE_BUSY;
+		page_entry->transit = false;
+		frame_wakeup(page_entry);
+		spinlock_release(&coremap_lock);
+		cv_broadcast(as->as_cv, as->as_lock);
+		spinlock_acquire(&coremap_lock);
 	}
-	
-	vfs_close(vfrom);
-	vfs_close(vto);
-	
-	return 0;	
+
+	memmove((void *)PADDR_TO_KVADDR(newpaddr),
+		(const void *)PADDR_TO_KVADDR(*paddrp), PAGE_SIZE);
+	m = frame_unmap(page_entry, as, vaddr);
+	KASSERT(page_entry->refcount > 0);
+
+	/* A private, dirty frame with no slot yet */
+	*pte = newpaddr | PTE_INUSE | PTE_VALID | PTE_REF | PTE_DIRTY
+		| (*pte & PTE_FILE);
+	update_page_frame_entry(vaddr, newpaddr, true, as, SWAP_NOSLOT);
+	VMSTAT_INC(cow_copies);
+	/* other threads of AS may still read the shared frame */
+	vmtlb_batch_init(&batch);
+	vmtlb_batch_add(&batch, as, vaddr);
+	spinlock_release(&coremap_lock);
+	vmtlb_batch_wait(&batch);
+	mapping_free_list(m);
+
+	*paddrp = newpaddr;
+	return true;
 }
-#if 0
+
+/*
+ * Bring the page at FAULTADDRESS, whose PTE is PTE, into memory. The
+ * PTE is marked PTE_BUSY and the as_lock dropped meanwhile, so other
+ * threads of the process can fault on other pages; one faulting on
+ * this page waits on as_cv. Returns with the PTE mapping the new frame
+ * and the as_lock held again, or an error with the PTE as it was.
+ */
+static
 int
-load_segment_to_swap_file(void* vaddr1,vaddr_t r_vaddr, size_t memsize)
-{
-	/*int k;
-	kprintf("printing segment\n");
-	for(k=0;k<memsize;k++)
-		kprintf("%c ",*((char*)(vaddr1+k)));
-	kprintf("\nend printing segment\n");
-	*/
-	size_t sz = memsize,offset,len; 
-	int i,j,npages;
-	vaddr_t vaddr = (vaddr_t)vaddr1,loaded_vaddr; 
-	kprintf("load_elf: load_segment_to_swap_file : buffer vaddr : %x actual vaddr : %x\n",vaddr,r_vaddr);
-	vaddr_t vd = vaddr;
-	struct addrspace *as = curthread->t_addrspace;
-	struct swap_file *sf = &(as->as_sf);
-	struct iovec iov;
-	struct uio u;
-	struct vnode * v;
+vm_pagein(struct addrspace *as, vaddr_t faultaddress, pte_t *pte,
+	  int faulttype)
+{
+	paddr_t paddrs[SWAP_MAXCLUSTER];
+	unsigned swapindex, nra;
+	paddr_t paddr;
+	pte_t pteval;
+	bool zeroed;
 	int result;
 
-	sz += vd & ~(vaddr_t)PAGE_FRAME;
-	vd &= PAGE_FRAME;
-	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+	KASSERT(lock_do_i_hold(as->as_lock));
+	KASSERT((*pte & (PTE_VALID|PTE_BUSY)) == 0);
 
-	npages = sz / PAGE_SIZE;
-	
-	r_vaddr &= r_vaddr;
-	
-	result = vfs_open(sf->sf_file, 6, 0664, &v);
-	if (result) {
-		return result;
-	}
-	for(i=1;i<=npages;i++)
+	nra = 0;
+	pteval = *pte;
+	swapindex = PTE_SWAPINDEX(pteval);
+	*pte |= PTE_BUSY;
+	if (pteval & PTE_SWAPPED)
 	{
-		for(j=0;j<sf->sf_pages;j++)
-		{
-			if((sf->sf_pagemapping[j].vaddress & PAGE_FRAME) == (r_vaddr & PAGE_FRAME))
-			{
-				 offset = j;
-				 break;
-			}
-		}
-		
-		if(i==1)
-		{
-			iov.iov_ubase = (void*)vaddr;
-			if(memsize+vaddr-vd <= PAGE_SIZE)
-				iov.iov_len = memsize;	
-			else
-				iov.iov_len = PAGE_SIZE+vd-vaddr;
-			u.uio_iov = &iov;
-			u.uio_iovcnt = 1;
-			u.uio_resid = iov.iov_len;          // amount to read from the file
-			u.uio_offset = offset*PAGE_SIZE;
-			u.uio_segflg = UIO_SYSSPACE;
-			u.uio_rw = UIO_WRITE;
-			u.uio_space = NULL;
-			len = iov.iov_len;
-			loaded_vaddr = iov.iov_ubase; 
-		}
-		else if(i==npages)
-		{
-			iov.iov_ubase = (void*)vd;
-			iov.iov_len = memsize;
-			u.uio_iov = &iov;
-			u.uio_iovcnt = 1;
-			u.uio_resid = memsize;          // amount to read from the file
-			u.uio_offset = offset*PAGE_SIZE;
-			u.uio_segflg = UIO_SYSSPACE;
-			u.uio_rw = UIO_WRITE;
-			u.uio_space = NULL;
-			len = iov.iov_len;	
-			loaded_vaddr = iov.iov_ubase;
-		}
-		else
-		{
-			iov.iov_ubase = (void*)vd;
-			iov.iov_len = PAGE_SIZE;
-			u.uio_iov = &iov;
-			u.uio_iovcnt = 1;
-			u.uio_resid = PAGE_SIZE;          // amount to read from the file
-			u.uio_offset = offset*PAGE_SIZE;
-			u.uio_segflg = UIO_SYSSPACE;
-			u.uio_rw = UIO_WRITE;
-			u.uio_space = NULL;
-			len = iov.iov_len;
-			loaded_vaddr = iov.iov_ubase;
-		}
-		
-		
-		
-		result = VOP_WRITE(v, &u);
-		if (result) {
-			return result;
-		}
-		kprintf("load_elf: loaded segment to swap file : offset : %d size : %d buffer vaddr : %x actual vaddr : %x\n",offset,len,loaded_vaddr,r_vaddr);
-		vd += PAGE_SIZE;
-		r_vaddr += PAGE_SIZE;
-		memsize-=len;
+		/* Reserve the read-ahead while the PTEs cannot change */
+		nra = readahead_reserve(as, faultaddress, swapindex, &paddrs[1]);
 	}
-	return 0;
-}
-#endif
+	lock_release(as->as_lock);
 
-int update_page_frame_entry(vaddr_t vaddr_fault, paddr_t paddr_fault, bool vbit, bool dbit, int id_thread,struct addrspace* as)
-{
-	//kprintf("Virtual Memory: update_page_frame_entry : vaddr : %x paddr: %x\n",vaddr_fault,paddr_fault);
-	lock_acquire(vm_lock);
-	struct vm_manager_page_entry* page_frame_entry;
-	int totpages = VM->num_page_frames;
-	int i;
+	/* only a page never written out starts from zeros */
+	zeroed = false;
+	paddr = getpage(1, (pteval & PTE_SWAPPED) ? NULL : &zeroed);
+	paddrs[0] = paddr;
 
-	for (i = 0 ; i < totpages ; i++)
+	if ((pteval & PTE_SWAPPED) == 0)
 	{
-		page_frame_entry = &(VM->page_frame_table[i]);
-		if (page_frame_entry->p_address == paddr_fault)
-		{
-			page_frame_entry->thread_id = id_thread;
-			page_frame_entry->v_address = vaddr_fault;
-			page_frame_entry->dirty_bit = dbit;
-			page_frame_entry->valid_bit = vbit;
-			page_frame_entry->reference_bit = true;
-			page_frame_entry->is_free = false;
-			page_frame_entry->as = as;
-			break;
-		}
+		/*
+		 * Never written out: demand-zero page, or first touch of
+		 * a page of the executable. No swap I/O either way.
+		 */
+		result = as_fill_page(as, faultaddress, paddr, pteval, zeroed);
+	}
+	else
+	{
+		/* Bring in the faulting page and its read-ahead in one go */
+		result = read_pages_from_swap(paddrs, nra + 1, swapindex);
+	}
 
+	lock_acquire(as->as_lock);
+	readahead_install(as, faultaddress, swapindex, &paddrs[1], nra,
+			  result != 0);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(*pte == (pteval | PTE_BUSY));
+	if (result)
+	{
+		coremap_free(coremap_entry(paddr));
+		*pte = pteval;
+		spinlock_release(&coremap_lock);
+		cv_broadcast(as->as_cv, as->as_lock);
+		return result;
 	}
-	lock_release(vm_lock);
-	KASSERT(i!=totpages);
+
+	/* Update the page table entry */
+	if (pteval & PTE_SWAPPED)
+		*pte = paddr | PTE_INUSE | PTE_SWAPPED | PTE_VALID | PTE_REF
+			| (pteval & (PTE_FILE|PTE_COW));
+	else
+		*pte = paddr | PTE_INUSE | PTE_VALID | PTE_REF
+			| (pteval & PTE_FILE);
+	if (faulttype != VM_FAULT_READ && (*pte & PTE_COW) == 0)
+		*pte |= PTE_DIRTY;
+
+	update_page_frame_entry(faultaddress, paddr, (*pte & PTE_DIRTY) != 0,
+		as, (pteval & PTE_SWAPPED) ? swapindex : SWAP_NOSLOT);
+	spinlock_release(&coremap_lock);
+	cv_broadcast(as->as_cv, as->as_lock);
+
+	if (pteval & PTE_SWAPPED)
+		VMSTAT_INC(page_fault);
 	return 0;
 }
 
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
+	struct vm_manager_page_entry *page_entry;
 	paddr_t paddr;
-	//kprintf("vm_fault called\n");
-	int i;
-	uint32_t ehi, elo;
+	uint32_t tlbelo;
 	struct addrspace *as;
-	int spl;
+	struct as_region *region;
+	uint32_t start;
+	bool resident;
+	int result;
 
-	lock_acquire(vm_metrics_lock);
-	VM_STATS->tlb_misses++;
-	lock_release(vm_metrics_lock);
+	start = getcycles();
+	VMSTAT_INC(tlb_misses);
 
 	faultaddress &= PAGE_FRAME;
-	//kprintf("Virtual Memory: vm_fault : vaddr : %x\n",faultaddress);
 	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
 
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
-		/* We always create pages read-write, so we can't get this */
-		panic("dumbvm: got VM_FAULT_READONLY\n");
+		/*
+		 * Pages are mapped read-only until they are dirtied;
+		 * this is the first write since the page was last clean.
+		 */
+		VMSTAT_INC(dirty_faults);
+		break;
 	    case VM_FAULT_READ:
 	    case VM_FAULT_WRITE:
 		break;
@@ -895,170 +2502,212 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EFAULT;
 	}
 	
-	struct page_table* page_t = &(as->as_pagetable);
-	int totpages = page_t->pt_totalpages;
-	struct page_table_entry* pt_pointer = page_t->pt_entrytable;
+	pte_t* pte;
 	
 	/* Assert that the address space has been set up properly. */
-	KASSERT(totpages != 0);
-	for(i=0;i<totpages;i++)
-	{
-		KASSERT(pt_pointer[i].vaddress!=0);
-		KASSERT((pt_pointer[i].vaddress & PAGE_FRAME) == pt_pointer[i].vaddress);
-		if(pt_pointer[i].vbit)
-		{
-			KASSERT(pt_pointer[i].paddress!=0);
-			KASSERT((pt_pointer[i].paddress & PAGE_FRAME) == pt_pointer[i].paddress);
-		}
-	}
-	//KASSERT(as->as_stackpbase!=0);
+	KASSERT(as->as_pagetable.pt_totalpages != 0);
+
+	/* The directory may not have existed yet at as_activate */
+	cpupagedirs[curcpu->c_number] = (vaddr_t)as->as_pagetable.pt_dir;
 	KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
 	
-	int id_thread = curthread->t_id;
+	lock_acquire(as->as_lock);
 
-	for (i = 0 ; i < totpages ; i++)
+	region = as_region_find(as, faultaddress);
+	if (region == NULL ||
+	    (faulttype != VM_FAULT_READ && (region->ar_perm & AR_WRITE) == 0))
 	{
-		if (pt_pointer[i].vaddress == faultaddress)
-		{
-			if (pt_pointer[i].vbit == true)
-			{
-				/* Page already in memory, just set paddr */
-				
-				lock_acquire(vm_metrics_lock);
-				VM_STATS->tlb_misses_with_page_in_memory++;
-				lock_release(vm_metrics_lock);
-
-				paddr = pt_pointer[i].paddress;
-				pt_pointer[i].rbit = true;
-				//kprintf("Virtual Memory: vm_fault : page already in memory. vadder: %x  paddr : %x\n",faultaddress,paddr);
-				if (faulttype == VM_FAULT_WRITE) pt_pointer[i].dbit = true;
-			}
-			else
-			{
-				/* Code for Swapping in Page, which has been swapped out once, so pt_entry exists */
-				
-				paddr = getpage(1);
-				//kprintf("Virtual Memory: vm_fault : page not in memory. vadder: %x  paddr : %x\n",faultaddress,paddr);
-				int result = read_page_from_swap(paddr, faultaddress, as);
-				if(result)
-					return result;
-
-				lock_acquire(vm_metrics_lock);
-				VM_STATS->page_fault++;
-				lock_release(vm_metrics_lock);
-
-				/* Update the page table entry */
-				pt_pointer[i].rbit = true;
-				pt_pointer[i].vbit = true;
-				pt_pointer[i].paddress = paddr;
-				
-				if (faulttype == VM_FAULT_WRITE) pt_pointer[i].dbit = true;
-			}
+		/* Not part of any region or the stack, or a store to text */
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
 
-			update_page_frame_entry(faultaddress, paddr, pt_pointer[i].vbit, pt_pointer[i].dbit,id_thread,as);
+ retry:
+	/* every page of a region has a PTE */
+	pte = pt_lookup(&as->as_pagetable, faultaddress);
+	KASSERT(pte != NULL && (*pte & PTE_INUSE));
 
-			break;
-		}
+	if (*pte & PTE_BUSY)
+	{
+		/* Another thread is bringing it in */
+		cv_wait(as->as_cv, as->as_lock);
+		goto retry;
 	}
-	if(i==totpages)
-	kprintf("paddr : %x and faultaddress %x\n",paddr,faultaddress);
-	/* make sure it's page-aligned */
-	KASSERT((paddr & PAGE_FRAME) == paddr);
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
+	spinlock_acquire(&coremap_lock);
+	resident = (*pte & PTE_VALID) != 0;
+	if (resident)
+	{
+		/* Page already in memory, just set paddr */
+		paddr = PTE_PADDR(*pte);
+		page_entry = coremap_entry(paddr);
+		if (page_entry->transit)
+		{
+			/* on its way out; wait and see where it went */
+			frame_wait(page_entry);
+			spinlock_release(&coremap_lock);
+			goto retry;
+		}
+		readahead_check_used(page_entry);
+		page_entry->reference_bit = true;
+		*pte |= PTE_REF;
+		/* a shared page is only dirtied once cow_fault has copied it */
+		if (faulttype != VM_FAULT_READ && (*pte & PTE_COW) == 0)
+		{
+			*pte |= PTE_DIRTY;
+			page_entry->dirty_bit = true;
+		}
+	}
+	spinlock_release(&coremap_lock);
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
+	if (resident)
+	{
+		VMSTAT_INC(tlb_misses_with_page_in_memory);
+	}
+	else
+	{
+		/* Code for Swapping in Page, which has been swapped out once, so pt_entry exists */
+		result = vm_pagein(as, faultaddress, pte, faulttype);
+		if (result)
+		{
+			lock_release(as->as_lock);
+			return result;
 		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-		tlb_write(ehi, elo, i);
-		splx(spl);
-		return 0;
+		paddr = PTE_PADDR(*pte);
 	}
-	
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+
+	if (faulttype != VM_FAULT_READ && (*pte & PTE_COW))
+	{
+		if (!cow_fault(as, faultaddress, pte, &paddr))
+			goto retry;
 	}
-	
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
+
+	/* make sure it's page-aligned */
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	/*
+	 * A clean page is mapped without TLBLO_DIRTY (i.e. read-only), so
+	 * the first write to it comes back as VM_FAULT_READONLY and marks
+	 * it dirty. So is a COW page, so that write can copy it.
+	 *
+	 * The pagedaemon may have taken the page again since; load the
+	 * TLB only if the PTE still maps it, or we would hand out a frame
+	 * that is no longer ours. Otherwise the access just faults again.
+	 */
+	spinlock_acquire(&coremap_lock);
+	if ((*pte & PTE_VALID) && PTE_PADDR(*pte) == paddr)
+	{
+		tlbelo = paddr | TLBLO_VALID;
+		if ((*pte & (PTE_DIRTY|PTE_COW)) == PTE_DIRTY) {
+			tlbelo |= TLBLO_DIRTY;
 		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+
 		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-		tlb_write(ehi, elo, i);
-		splx(spl);
-		return 0;
+		vmtlb_load(faultaddress, tlbelo);
 	}
+	spinlock_release(&coremap_lock);
+	lock_release(as->as_lock);
 
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
-	splx(spl);
-	return EFAULT;
+	vmstat_latency(resident ? VMLAT_MINOR : VMLAT_MAJOR, start);
+	VMTRACE(resident ? VMTRACE_MINOR : VMTRACE_MAJOR,
+		faulttype != VM_FAULT_READ, as, faultaddress,
+		coremap_entry(paddr) - VM->page_frame_table);
+	return 0;
 }
 
 
 
-/* Allocate/free some kernel-space virtual pages */
+/*
+ * Allocate/free some kernel-space virtual pages.
+ *
+ * Once the VM is up, kernel pages come from the coremap as a wired
+ * run. If no run is free, user pages are evicted to make room, when
+ * the caller is allowed to sleep. Memory stolen before the coremap
+ * was set up is never freed.
+ */
 vaddr_t 
 alloc_kpages(int npages)
 {
+	struct vm_manager_page_entry *page_entry;
 	paddr_t pa;
-	pa = getppages(npages);
-	if (pa==0) {
-		return 0;
 
+	KASSERT(npages > 0);
+	if (!vm_ready) {
+		pa = getppages(npages);
+		return pa == 0 ? 0 : PADDR_TO_KVADDR(pa);
+	}
+
+	page_entry = kpages_take(npages);
+	if (page_entry != NULL) {
+		return PADDR_TO_KVADDR(coremap_paddr(page_entry));
 	}
-	//kprintf("alloc_kpages returning paddress %x\n",PADDR_TO_KVADDR(pa));
-	return PADDR_TO_KVADDR(pa);
+
+	if (!kpages_maysleep()) {
+		return 0;
+	}
+	page_entry = kpages_reclaim(npages);
+	if (page_entry == NULL) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(coremap_paddr(page_entry));
 }
 
 void 
 free_kpages(vaddr_t addr)
 {
-	/* nothing - leak the memory. */
-	//kprintf("free_kpages called on vaddr : %x\n",addr);
-	(void)addr;
-}
-
-void
-vm_tlbshootdown_all(void)
-{
-	//panic("dumbvm tried to do tlb shootdown?!\n");
-	int spl = splhigh();
-	int i;
-	
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	struct vm_manager_page_entry *head;
+	paddr_t pa;
+	unsigned i, npages;
+
+	KASSERT(addr >= MIPS_KSEG0);
+	pa = addr - MIPS_KSEG0;
+	if (!vm_ready || pa < VM->first_paddr ||
+	    pa >= VM->first_paddr + VM->num_page_frames * PAGE_SIZE) {
+		/* stolen with ram_stealmem during boot; leak it */
+		return;
 	}
 
-	splx(spl);
-}
-
-void
-vm_tlbshootdown(const struct tlbshootdown *ts)
-{
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	head = coremap_entry(pa);
+	spinlock_acquire(&coremap_lock);
+	KASSERT(head->wired && head->kpages > 0);
+	npages = head->kpages;
+	head->kpages = 0;
+	for (i = 0; i < npages; i++)
+	{
+		head[i].wired = false;
+		freelist_push(&head[i]);
+	}
+	VM->num_wired -= npages;
+	VMSTAT_ADD(kpages_freed, npages);
+	spinlock_release(&coremap_lock);
 }
 
 void reset_reference_bit(void)
 {
-	lock_acquire(vm_lock);
+	/* The clock hand clears reference bits itself */
+	if (vm_replacement_policy != VM_POLICY_REFSCAN)
+		return;
+
 	struct vm_manager_page_entry* page_frame_entry;
 	int totpages = VM->num_page_frames;
 	int i;
 
+	spinlock_acquire(&coremap_lock);
+
 	for (i = 0 ; i < totpages ; i++)
 	{
 		page_frame_entry = &(VM->page_frame_table[i]);
+		if (page_frame_entry->is_free)
+			continue;
 		page_frame_entry->reference_bit = false;
+		frame_clear_ref(page_frame_entry);
 	}
-	lock_release(vm_lock);
+	spinlock_release(&coremap_lock);
+
+	/*
+	 * Re-sample: pages that stay in use fault again and get their
+	 * reference bit back. A new ASID generation makes every CPU
+	 * flush on its next activation; do ours now.
+	 */
+	vmtlb_newgeneration();
 }
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Sparse two-level page table.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <pagetable.h>
+
+void
+pt_init(struct page_table *pt)
+{
+	pt->pt_dir = NULL;
+	pt->pt_totalpages = 0;
+}
+
+void
+pt_destroy(struct page_table *pt)
+{
+	unsigned i;
+
+	if (pt->pt_dir == NULL) {
+		return;
+	}
+	for (i=0; i<PT_DIRENTRIES; i++) {
+		if (pt->pt_dir[i] != NULL) {
+			kfree(pt->pt_dir[i]);
+		}
+	}
+	kfree(pt->pt_dir);
+	pt->pt_dir = NULL;
+	pt->pt_totalpages = 0;
+}
+
+pte_t *
+pt_lookup(struct page_table *pt, vaddr_t vaddr)
+{
+	pte_t *leaf;
+
+	if (pt->pt_dir == NULL) {
+		return NULL;
+	}
+	leaf = pt->pt_dir[PT_DIRINDEX(vaddr)];
+	if (leaf == NULL) {
+		return NULL;
+	}
+	return &leaf[PT_LEAFINDEX(vaddr)];
+}
+
+pte_t *
+pt_define(struct page_table *pt, vaddr_t vaddr)
+{
+	pte_t *leaf;
+	pte_t *pte;
+
+	if (pt->pt_dir == NULL) {
+		pt->pt_dir = kmalloc(PT_DIRENTRIES * sizeof(pte_t *));
+		if (pt->pt_dir == NULL) {
+			return NULL;
+		}
+		bzero(pt->pt_dir, PT_DIRENTRIES * sizeof(pte_t *));
+	}
+
+	leaf = pt->pt_dir[PT_DIRINDEX(vaddr)];
+	if (leaf == NULL) {
+		leaf = kmalloc(PT_LEAFENTRIES * sizeof(pte_t));
+		if (leaf == NULL) {
+			return NULL;
+		}
+		bzero(leaf, PT_LEAFENTRIES * sizeof(pte_t));
+		pt->pt_dir[PT_DIRINDEX(vaddr)] = leaf;
+	}
+
+	pte = &leaf[PT_LEAFINDEX(vaddr)];
+	if ((*pte & PTE_INUSE) == 0) {
+		*pte = PTE_INUSE;
+		pt->pt_totalpages++;
+	}
+	return pte;
+}
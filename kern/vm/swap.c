@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Swap device and slot allocator.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <stat.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <swap.h>
+
+static struct vnode *swap_vnode;	/* the swap device, open for the life of the system */
+static struct bitmap *swap_map;		/* one bit per slot, set if in use */
+static uint16_t *swap_refs;		/* holders of each slot in use */
+static unsigned swap_nslots;		/* number of page-sized slots */
+static unsigned swap_used;		/* number of slots in use */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Open the swap device and size the slot bitmap from it. If there is
+ * no usable device the system runs without swap and swap_alloc fails.
+ */
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat st;
+	int result;
+
+	/* vfs_open destroys the string it is passed */
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: cannot open %s: %s\n", SWAP_DEVICE,
+			strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		kprintf("swap: cannot stat %s: %s\n", SWAP_DEVICE,
+			strerror(result));
+		vfs_close(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots > SWAP_MAXSLOTS) {
+		swap_nslots = SWAP_MAXSLOTS;
+	}
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: cannot allocate bitmap for %u slots\n",
+		      swap_nslots);
+	}
+	swap_refs = kmalloc(swap_nslots * sizeof(swap_refs[0]));
+	if (swap_refs == NULL) {
+		panic("swap: cannot allocate refcounts for %u slots\n",
+		      swap_nslots);
+	}
+	swap_used = 0;
+
+	kprintf("swap: %s, %u pages\n", SWAP_DEVICE, swap_nslots);
+}
+
+/*
+ * Close the swap device. Called at shutdown, after the last user
+ * process is gone.
+ */
+void
+swap_shutdown(void)
+{
+	if (swap_vnode == NULL) {
+		return;
+	}
+	vfs_close(swap_vnode);
+	swap_vnode = NULL;
+	if (swap_used != 0) {
+		kprintf("swap: %u slots still in use at shutdown\n", swap_used);
+	}
+}
+
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	if (swap_map == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		swap_refs[*slot] = 1;
+		swap_used++;
+	}
+	spinlock_release(&swap_lock);
+
+	return result ? ENOSPC : 0;
+}
+
+int
+swap_alloc_run(unsigned npages, unsigned *slot)
+{
+	unsigned start, i;
+
+	if (swap_map == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	for (start = 0; start + npages <= swap_nslots; start++) {
+		for (i = 0; i < npages; i++) {
+			if (bitmap_isset(swap_map, start + i)) {
+				break;
+			}
+		}
+		if (i == npages) {
+			for (i = 0; i < npages; i++) {
+				bitmap_mark(swap_map, start + i);
+				swap_refs[start + i] = 1;
+			}
+			swap_used += npages;
+			spinlock_release(&swap_lock);
+			*slot = start;
+			return 0;
+		}
+		/* skip past the slot in use */
+		start += i;
+	}
+	spinlock_release(&swap_lock);
+
+	return ENOSPC;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	KASSERT(swap_refs[slot] > 0);
+	swap_refs[slot]--;
+	if (swap_refs[slot] == 0) {
+		bitmap_unmark(swap_map, slot);
+		swap_used--;
+	}
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Add a holder to a slot in use. Each PTE naming the slot, and each
+ * frame caching it, holds one reference; the slot is released when
+ * the last of them calls swap_free.
+ */
+void
+swap_dup(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	KASSERT(swap_refs[slot] < 0xffff);
+	swap_refs[slot]++;
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * True if more than one holder refers to SLOT, so its contents must
+ * not be overwritten.
+ */
+bool
+swap_shared(unsigned slot)
+{
+	bool shared;
+
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	shared = swap_refs[slot] > 1;
+	spinlock_release(&swap_lock);
+
+	return shared;
+}
+
+/*
+ * Move NPAGES pages between kernel buffers and consecutive slots
+ * starting at SLOT. This is a single sector-aligned transfer on the
+ * raw device.
+ */
+static
+int
+swap_io(void **kbufs, unsigned npages, unsigned slot, enum uio_rw rw)
+{
+	struct iovec iov[SWAP_MAXCLUSTER];
+	struct uio u;
+	unsigned i;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(npages > 0 && npages <= SWAP_MAXCLUSTER);
+	KASSERT(slot + npages <= swap_nslots);
+
+	for (i=0; i<npages; i++) {
+		iov[i].iov_kbase = kbufs[i];
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	u.uio_iov = iov;
+	u.uio_iovcnt = npages;
+	u.uio_offset = (off_t)slot * PAGE_SIZE;
+	u.uio_resid = npages * PAGE_SIZE;
+	u.uio_segflg = UIO_SYSSPACE;
+	u.uio_rw = rw;
+	u.uio_space = NULL;
+
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &u);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &u);
+	}
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_read(void *kbuf, unsigned slot)
+{
+	return swap_io(&kbuf, 1, slot, UIO_READ);
+}
+
+int
+swap_write(void *kbuf, unsigned slot)
+{
+	return swap_io(&kbuf, 1, slot, UIO_WRITE);
+}
+
+int
+swap_readv(void **kbufs, unsigned npages, unsigned slot)
+{
+	return swap_io(kbufs, npages, slot, UIO_READ);
+}
+
+int
+swap_writev(void **kbufs, unsigned npages, unsigned slot)
+{
+	return swap_io(kbufs, npages, slot, UIO_WRITE);
+}
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * VM statistics: per-CPU counters and latency histograms, and the
+ * code to add them up and print them.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <vmstat.h>
+
+struct vmstat vmstat_cpus[MAXCPUS];
+
+static const char *const vmlat_names[VMLAT_NKINDS] = {
+	"Minor faults",
+	"Major faults",
+	"Evictions",
+	"Swap reads",
+	"Swap writes",
+};
+
+void
+vmstat_latency(unsigned kind, uint32_t start)
+{
+	struct vmstat_hist *h;
+	uint32_t cycles;
+	unsigned b;
+
+	KASSERT(kind < VMLAT_NKINDS);
+	cycles = getcycles() - start;
+	for (b = 0; b < VMSTAT_NBUCKETS - 1; b++) {
+		if ((cycles >> (VMSTAT_HISTSHIFT + b)) == 0) {
+			break;
+		}
+	}
+	h = &vmstat_cpus[curcpu->c_number].vs_lat[kind];
+	h->h_count[b]++;
+	h->h_us += cycles / (getcyclefreq() / 1000000);
+}
+
+void
+vmstat_sum(struct vmstat *vs)
+{
+	const unsigned *src;
+	unsigned *dst;
+	unsigned i, j, k;
+
+	bzero(vs, sizeof(*vs));
+	for (i = 0; i < MAXCPUS; i++) {
+		src = (const unsigned *)&vmstat_cpus[i].vs_count;
+		dst = (unsigned *)&vs->vs_count;
+		for (j = 0; j < sizeof(vs->vs_count) / sizeof(unsigned); j++) {
+			dst[j] += src[j];
+		}
+		for (k = 0; k < VMLAT_NKINDS; k++) {
+			for (j = 0; j < VMSTAT_NBUCKETS; j++) {
+				vs->vs_lat[k].h_count[j] +=
+					vmstat_cpus[i].vs_lat[k].h_count[j];
+			}
+			vs->vs_lat[k].h_us += vmstat_cpus[i].vs_lat[k].h_us;
+		}
+	}
+}
+
+/*
+ * NOW minus SINCE into D. Counters wrap around; the difference is
+ * still right as long as they do not wrap twice in between.
+ */
+static
+void
+vmstat_diff(struct vmstat *d, const struct vmstat *now,
+	    const struct vmstat *since)
+{
+	const unsigned *a, *b;
+	unsigned *r;
+	unsigned j, k;
+
+	a = (const unsigned *)&now->vs_count;
+	b = (const unsigned *)&since->vs_count;
+	r = (unsigned *)&d->vs_count;
+	for (j = 0; j < sizeof(d->vs_count) / sizeof(unsigned); j++) {
+		r[j] = a[j] - b[j];
+	}
+	for (k = 0; k < VMLAT_NKINDS; k++) {
+		for (j = 0; j < VMSTAT_NBUCKETS; j++) {
+			d->vs_lat[k].h_count[j] = now->vs_lat[k].h_count[j] -
+				since->vs_lat[k].h_count[j];
+		}
+		d->vs_lat[k].h_us = now->vs_lat[k].h_us -
+			since->vs_lat[k].h_us;
+	}
+}
+
+static
+void
+vmstat_printhist(const char *name, const struct vmstat_hist *h)
+{
+	unsigned n, j;
+
+	n = 0;
+	for (j = 0; j < VMSTAT_NBUCKETS; j++) {
+		n += h->h_count[j];
+	}
+	kprintf("%s : %u (average %u us)\n", name, n,
+		n == 0 ? 0 : h->h_us / n);
+	if (n == 0) {
+		return;
+	}
+	kprintf("   cycles:");
+	for (j = 0; j < VMSTAT_NBUCKETS; j++) {
+		if (h->h_count[j] == 0) {
+			continue;
+		}
+		if (j == VMSTAT_NBUCKETS - 1) {
+			kprintf(" >=%u:%u", 1U << (VMSTAT_HISTSHIFT + j - 1),
+				h->h_count[j]);
+		}
+		else {
+			kprintf(" <%u:%u", 1U << (VMSTAT_HISTSHIFT + j),
+				h->h_count[j]);
+		}
+	}
+	kprintf("\n");
+}
+
+void
+vmstat_print(const struct vmstat *now, const struct vmstat *since)
+{
+	struct vmstat d;
+	const struct vmstat_counters *c;
+	unsigned k;
+
+	if (since != NULL) {
+		vmstat_diff(&d, now, since);
+		now = &d;
+	}
+	c = &now->vs_count;
+
+	kprintf("Page replacement policy : %s\n",vm_policyname());
+	kprintf("Number of TLB misses not handled by the refill handler : %u\n",c->tlb_misses);
+	kprintf("Number of TLB misses where page was found in memory : %u\n",c->tlb_misses_with_page_in_memory);
+	kprintf("Number of page faults : %u\n",c->page_fault);
+	kprintf("Number of page faults where free page was found : %u\n",c->vm_fault_with_free_page);
+	kprintf("Number of page faults where LRU was used : %u\n",c->vm_fault_with_lru);
+	kprintf("Number of demand-zero pages filled : %u\n",c->zero_fills);
+	kprintf("Pre-zeroed pool : %u hits, %u misses (%u%% hit), %u frames zeroed at idle, %d ready\n",
+		c->zero_pool_hits, c->zero_pool_misses,
+		c->zero_pool_hits + c->zero_pool_misses == 0 ? 0 :
+		c->zero_pool_hits * 100 / (c->zero_pool_hits + c->zero_pool_misses),
+		c->zero_pool_filled, VM->num_zeroed);
+	kprintf("Number of pages read from executables : %u\n",c->file_fills);
+	kprintf("Number of pages shared copy-on-write : %u\n",c->cow_shared);
+	kprintf("Number of shared pages copied on write : %u\n",c->cow_copies);
+	kprintf("Number of shared pages reused on write : %u\n",c->cow_reuses);
+	kprintf("Number of ASID generations started : %u\n",c->asid_rollovers);
+	kprintf("Number of full TLB flushes : %u\n",c->tlb_flushes);
+	kprintf("Number of single TLB entries invalidated : %u\n",c->tlb_invalidations);
+	kprintf("Number of TLB shootdown IPIs sent : %u\n",c->tlb_ipis);
+	kprintf("Number of TLB entries shot down by them : %u\n",c->tlb_shootdowns);
+	kprintf("Number of TLB entries displaced at random : %u\n",c->tlb_replacements);
+	kprintf("Kernel pages : %u from the coremap (%d held, %u evicted for them), %u freed\n",
+		c->kpages_coremap, VM->num_wired,
+		c->kpages_reclaimed, c->kpages_freed);
+	kprintf("Number of first writes to clean pages : %u\n",c->dirty_faults);
+	kprintf("Number of clean pages evicted without a write : %u\n",c->clean_evictions);
+	kprintf("Free frame watermarks : low %d high %d (%d free now)\n",
+		VM->low_water, VM->high_water, VM->num_free);
+	kprintf("Pagedaemon : %u wakeups, %u pages cleaned in %u clusters, %u frames freed\n",
+		c->pagedaemon_wakeups,c->pagedaemon_cleaned,
+		c->pageout_clusters,c->pagedaemon_freed);
+	kprintf("Read-ahead : %u pages prefetched, %u used (%u%%), %u wasted, window %d\n",
+		c->prefetch_issued, c->prefetch_hits,
+		c->prefetch_issued == 0 ? 0 :
+		c->prefetch_hits * 100 / c->prefetch_issued,
+		c->prefetch_wasted, VM->readahead_window);
+	kprintf("Number of pages read from swap : %u\n",c->page_ins);
+	kprintf("Number of pages written to swap : %u\n",c->page_outs);
+	for (k = 0; k < VMLAT_NKINDS; k++) {
+		vmstat_printhist(vmlat_names[k], &now->vs_lat[k]);
+	}
+}
+
+int
+vmstat_watch(int interval, int count)
+{
+	struct vmstat *prev, *now, *t;
+	int i;
+
+	KASSERT(interval > 0);
+	prev = kmalloc(sizeof(*prev));
+	now = kmalloc(sizeof(*now));
+	if (prev == NULL || now == NULL) {
+		kfree(prev);
+		kfree(now);
+		return ENOMEM;
+	}
+
+	vmstat_sum(prev);
+	for (i = 0; i < count; i++) {
+		clocksleep(interval);
+		vmstat_sum(now);
+		kprintf("\n--- last %d s (%d of %d) ---\n", interval, i+1, count);
+		vmstat_print(now, prev);
+		t = prev;
+		prev = now;
+		now = t;
+	}
+
+	kfree(prev);
+	kfree(now);
+	return 0;
+}
@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * TLB management: address space IDs, slot replacement, invalidation
+ * and shootdowns.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <vmtlb.h>
+#include <vmstat.h>
+
+/*
+ * Address space IDs are handed out in order; when they run out a new
+ * generation starts and numbering begins again. A CPU flushes its TLB
+ * the first time it loads an ASID of a newer generation than the one
+ * its TLB holds, so a translation can never be matched under a reused
+ * ASID. ASID_NONE is loaded while no address space is active and is
+ * never handed out.
+ */
+#define ASID_NONE 0
+#define TLBHI_ENTRY(vaddr, asid) \
+	(((vaddr) & TLBHI_VPAGE) | ((uint32_t)(asid) << TLBHI_PIDSHIFT))
+
+#if MAXCPUS > 32
+#error "as_cpus and the batch CPU masks hold at most 32 CPUs"
+#endif
+#define CPUBIT(n) ((uint32_t)1 << (n))
+
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static uint32_t asid_next = ASID_NONE + 1;	/* next ASID to hand out */
+static uint32_t asid_generation = 1;		/* current generation */
+
+/*
+ * The counters below are bumped with interrupts off but without a
+ * lock, so on a multiprocessor they may lose the odd count.
+ */
+
+/*
+ * Invalidate every slot of this CPU's TLB. Called with interrupts off;
+ * leaves the ASID to be reloaded by the caller.
+ */
+static
+void
+tlb_clear(void)
+{
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	curcpu->c_tlbnext = 0;
+	VMSTAT_INC(tlb_flushes);
+}
+
+/*
+ * Drop the translation for VADDR under ASID, if any, from this CPU's
+ * TLB. Entries of an older ASID generation than the TLB holds are gone
+ * already. If ASIDGEN is newer, this CPU has not switched address
+ * spaces since the rollover and may still run the address space under
+ * its ASID of an older generation, which we do not know; flush it all.
+ */
+static
+void
+tlb_invalidate_local(vaddr_t vaddr, uint32_t asid, uint32_t asidgen)
+{
+	int i, spl;
+
+	spl = splhigh();
+	if ((int32_t)(asidgen - curcpu->c_asidgen) > 0) {
+		tlb_clear();
+		tlb_setasid(curcpu->c_asid);
+	}
+	else if (asidgen == curcpu->c_asidgen) {
+		i = tlb_probe(TLBHI_ENTRY(vaddr, asid), 0);
+		if (i >= 0) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+			VMSTAT_INC(tlb_invalidations);
+		}
+		tlb_setasid(curcpu->c_asid);
+	}
+	splx(spl);
+}
+
+/*
+ * Start a new ASID generation. Called with asid_lock held.
+ */
+static
+void
+asid_newgeneration(void)
+{
+	KASSERT(spinlock_do_i_hold(&asid_lock));
+
+	asid_generation++;
+	asid_next = ASID_NONE + 1;
+	VMSTAT_INC(asid_rollovers);
+}
+
+void
+vmtlb_activate(struct addrspace *as)
+{
+	int spl;
+
+	spl = splhigh();
+
+	if (as == NULL) {
+		curcpu->c_asid = ASID_NONE;
+		cpupagedirs[curcpu->c_number] = 0;
+		tlb_setasid(ASID_NONE);
+		splx(spl);
+		return;
+	}
+
+	spinlock_acquire(&asid_lock);
+	if (as->as_asidgen != asid_generation) {
+		if (asid_next == NUM_ASID) {
+			asid_newgeneration();
+		}
+		as->as_asid = asid_next++;
+		as->as_asidgen = asid_generation;
+		/*
+		 * as_cpus is kept: a CPU still in an older generation
+		 * may be running AS under its old ASID.
+		 */
+	}
+	as->as_cpus |= CPUBIT(curcpu->c_number);
+	if (curcpu->c_asidgen != as->as_asidgen) {
+		/* ASIDs of the new generation may be in use here already */
+		tlb_clear();
+		curcpu->c_asidgen = as->as_asidgen;
+	}
+	curcpu->c_asid = as->as_asid;
+	spinlock_release(&asid_lock);
+
+	/*
+	 * For the refill handler. A CPU that goes on to run only kernel
+	 * threads keeps the old value, but takes no user TLB misses until
+	 * it activates another address space; vmtlb_deactivate clears it
+	 * before the directory is freed.
+	 */
+	cpupagedirs[curcpu->c_number] = (vaddr_t)as->as_pagetable.pt_dir;
+
+	tlb_setasid(curcpu->c_asid);
+	splx(spl);
+}
+
+void
+vmtlb_deactivate(struct addrspace *as)
+{
+	vaddr_t dir = (vaddr_t)as->as_pagetable.pt_dir;
+	unsigned i;
+	int spl;
+
+	spl = splhigh();
+
+	if (as->as_asidgen == curcpu->c_asidgen &&
+	    as->as_asid == curcpu->c_asid) {
+		curcpu->c_asid = ASID_NONE;
+		tlb_setasid(ASID_NONE);
+	}
+
+	/*
+	 * Any CPU that ran AS may still point the refill handler at its
+	 * directory. Another CPU may be storing a new directory in its
+	 * slot as we look at it; if we then clear it, its next miss just
+	 * goes to vm_fault, which stores it again.
+	 */
+	if (dir != 0) {
+		for (i = 0; i < MAXCPUS; i++) {
+			if ((as->as_cpus & CPUBIT(i)) && cpupagedirs[i] == dir) {
+				cpupagedirs[i] = 0;
+			}
+		}
+	}
+
+	splx(spl);
+}
+
+void
+vmtlb_newgeneration(void)
+{
+	spinlock_acquire(&asid_lock);
+	asid_newgeneration();
+	spinlock_release(&asid_lock);
+
+	/* flushes here, now */
+	vmtlb_activate(curthread->t_addrspace);
+}
+
+void
+vmtlb_flush(void)
+{
+	int spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	tlb_clear();
+	tlb_setasid(curcpu->c_asid);
+	splx(spl);
+}
+
+void
+vmtlb_batch_init(struct vmtlb_batch *b)
+{
+	b->tb_n = 0;
+	b->tb_waitcpus = 0;
+}
+
+/*
+ * With ASIDs a TLB may hold entries of AS while running something
+ * else, so this goes to every CPU that has ever activated AS, not just
+ * those running it now. as_cpus only grows, and only under asid_lock,
+ * so a CPU missing from it has never loaded any ASID of AS; if it
+ * does after we look, the caller has changed the PTE already and it
+ * can only see the new one. An AS never activated has no CPUs.
+ */
+void
+vmtlb_batch_add(struct vmtlb_batch *b, struct addrspace *as, vaddr_t vaddr)
+{
+	struct tlbshootdown ts;
+	uint32_t cpus;
+
+	spinlock_acquire(&asid_lock);
+	ts.ts_asid = as->as_asid;
+	ts.ts_asidgen = as->as_asidgen;
+	ts.ts_vaddr = vaddr & PAGE_FRAME;
+	cpus = as->as_cpus;
+	spinlock_release(&asid_lock);
+
+	tlb_invalidate_local(ts.ts_vaddr, ts.ts_asid, ts.ts_asidgen);
+	cpus &= ~CPUBIT(curcpu->c_number);
+	if (cpus == 0) {
+		return;
+	}
+
+	if (b->tb_n == TLBSHOOTDOWN_MAX) {
+		vmtlb_batch_send(b);
+	}
+	b->tb_ents[b->tb_n] = ts;
+	b->tb_cpus[b->tb_n] = cpus;
+	b->tb_n++;
+}
+
+/*
+ * Each CPU gets the entries meant for it in a single IPI.
+ */
+void
+vmtlb_batch_send(struct vmtlb_batch *b)
+{
+	struct tlbshootdown ents[TLBSHOOTDOWN_MAX];
+	uint32_t cpus;
+	unsigned c, i, n;
+
+	cpus = 0;
+	for (i=0; i<b->tb_n; i++) {
+		cpus |= b->tb_cpus[i];
+	}
+
+	for (c=0; cpus != 0; c++) {
+		if ((cpus & CPUBIT(c)) == 0) {
+			continue;
+		}
+		cpus &= ~CPUBIT(c);
+
+		n = 0;
+		for (i=0; i<b->tb_n; i++) {
+			if (b->tb_cpus[i] & CPUBIT(c)) {
+				ents[n++] = b->tb_ents[i];
+			}
+		}
+		b->tb_tickets[c] = ipi_tlbshootdown_many(cpu_get(c), ents, n);
+		b->tb_waitcpus |= CPUBIT(c);
+		VMSTAT_INC(tlb_ipis);
+		VMSTAT_ADD(tlb_shootdowns, n);
+	}
+	b->tb_n = 0;
+}
+
+void
+vmtlb_batch_wait(struct vmtlb_batch *b)
+{
+	unsigned c;
+
+	vmtlb_batch_send(b);
+	for (c=0; b->tb_waitcpus != 0; c++) {
+		if (b->tb_waitcpus & CPUBIT(c)) {
+			ipi_tlbshootdown_wait(cpu_get(c), b->tb_tickets[c]);
+			b->tb_waitcpus &= ~CPUBIT(c);
+		}
+	}
+}
+
+void
+vmtlb_load(vaddr_t vaddr, uint32_t elo)
+{
+	uint32_t ehi;
+	int i, spl;
+
+	/* Tagged with our ASID, so it survives switches to other processes */
+	ehi = TLBHI_ENTRY(vaddr, curcpu->c_asid);
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	/* Replace the entry in place if there is one (the READONLY case) */
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+	}
+	else if (curcpu->c_tlbnext < NUM_TLB) {
+		/* Still filling up since the last flush */
+		tlb_write(ehi, elo, curcpu->c_tlbnext++);
+	}
+	else {
+		/*
+		 * Full, most likely with entries of other address spaces
+		 * too. Displace one entry rather than flushing them all.
+		 */
+		tlb_random(ehi, elo);
+		VMSTAT_INC(tlb_replacements);
+	}
+	/* Each of the writes above left our ASID loaded */
+
+	splx(spl);
+}
+
+/*
+ * Shootdown handlers, called from interprocessor_interrupt.
+ */
+
+void
+vm_tlbshootdown_all(void)
+{
+	vmtlb_flush();
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	tlb_invalidate_local(ts->ts_vaddr, ts->ts_asid, ts->ts_asidgen);
+}
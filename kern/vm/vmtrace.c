@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Page fault tracing: per-CPU ring buffers of faults and evictions,
+ * and the code to dump them to a file.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <vmtrace.h>
+
+struct vmtrace_rec {
+	uint32_t vt_secs;	/* since tracing was first started */
+	uint32_t vt_cycles;	/* into that second */
+	vaddr_t vt_as;		/* the address space, by address */
+	uint32_t vt_vpn;
+	int32_t vt_frame;	/* coremap index, or -1 */
+	char vt_kind;		/* VMTRACE_* */
+	char vt_rw;		/* 'r', 'w' or '-' */
+};
+
+/*
+ * One CPU's ring. tc_lock is only ever contended by a dump; it keeps
+ * a record from being half written when the dump reads it.
+ *
+ * Records are often made with coremap_lock held, where gettime(), a
+ * bus read, costs too much, so they are timed with the cycle counter.
+ * Each CPU keeps its own clock of seconds and cycles since tracing
+ * was first started, advanced by the counter's progress since its
+ * last record. All clocks start from one reading of the counter,
+ * which is right as long as the CPUs' counters run together, as they
+ * do on System/161. A CPU that records nothing for a whole turn of
+ * its counter (about three minutes) loses that turn.
+ */
+struct vmtrace_cpu {
+	struct spinlock tc_lock;
+	struct vmtrace_rec *tc_recs;	/* VMTRACE_NRECS of them */
+	unsigned tc_next;		/* slot for the next record */
+	unsigned tc_count;		/* records held */
+	unsigned tc_lost;		/* records overwritten */
+	uint32_t tc_lastcycles;		/* counter at the last record */
+	uint32_t tc_secs;		/* clock: seconds... */
+	uint32_t tc_cycles;		/* ...and cycles into the next */
+};
+
+volatile bool vmtrace_enabled = false;
+static struct vmtrace_cpu *vmtrace_cpus;
+static unsigned vmtrace_ncpus;
+static uint32_t vmtrace_freq;		/* cycles per second */
+
+/*
+ * Advance TC's clock to the counter reading CYCLES.
+ */
+static
+void
+vmtrace_tick(struct vmtrace_cpu *tc, uint32_t cycles)
+{
+	uint32_t delta;
+
+	delta = cycles - tc->tc_lastcycles;
+	tc->tc_lastcycles = cycles;
+	while (delta >= vmtrace_freq) {
+		tc->tc_secs++;
+		delta -= vmtrace_freq;
+	}
+	tc->tc_cycles += delta;
+	if (tc->tc_cycles >= vmtrace_freq) {
+		tc->tc_secs++;
+		tc->tc_cycles -= vmtrace_freq;
+	}
+}
+
+void
+vmtrace_record(int kind, bool write, struct addrspace *as, vaddr_t vaddr,
+	       int frame)
+{
+	struct vmtrace_cpu *tc;
+	struct vmtrace_rec *r;
+
+	KASSERT(curcpu->c_number < vmtrace_ncpus);
+
+	tc = &vmtrace_cpus[curcpu->c_number];
+	spinlock_acquire(&tc->tc_lock);
+	vmtrace_tick(tc, getcycles());
+	r = &tc->tc_recs[tc->tc_next];
+	r->vt_secs = tc->tc_secs;
+	r->vt_cycles = tc->tc_cycles;
+	r->vt_as = (vaddr_t)as;
+	r->vt_vpn = vaddr / PAGE_SIZE;
+	r->vt_frame = frame;
+	r->vt_kind = kind;
+	if (kind == VMTRACE_MINOR || kind == VMTRACE_MAJOR) {
+		r->vt_rw = write ? 'w' : 'r';
+	}
+	else {
+		r->vt_rw = '-';
+	}
+	tc->tc_next = (tc->tc_next + 1) % VMTRACE_NRECS;
+	if (tc->tc_count < VMTRACE_NRECS) {
+		tc->tc_count++;
+	}
+	else {
+		tc->tc_lost++;
+	}
+	spinlock_release(&tc->tc_lock);
+}
+
+int
+vmtrace_start(void)
+{
+	struct vmtrace_cpu *cpus;
+	uint32_t now;
+	unsigned i, n;
+
+	if (vmtrace_cpus == NULL) {
+		vmtrace_freq = getcyclefreq();
+		now = getcycles();
+		n = cpu_count();
+		cpus = kmalloc(n * sizeof(struct vmtrace_cpu));
+		if (cpus == NULL) {
+			return ENOMEM;
+		}
+		for (i = 0; i < n; i++) {
+			spinlock_init(&cpus[i].tc_lock);
+			cpus[i].tc_next = 0;
+			cpus[i].tc_count = 0;
+			cpus[i].tc_lost = 0;
+			cpus[i].tc_lastcycles = now;
+			cpus[i].tc_secs = 0;
+			cpus[i].tc_cycles = 0;
+			cpus[i].tc_recs = kmalloc(VMTRACE_NRECS *
+						  sizeof(struct vmtrace_rec));
+			if (cpus[i].tc_recs == NULL) {
+				while (i-- > 0) {
+					kfree(cpus[i].tc_recs);
+					spinlock_cleanup(&cpus[i].tc_lock);
+				}
+				kfree(cpus);
+				return ENOMEM;
+			}
+		}
+		vmtrace_ncpus = n;
+		vmtrace_cpus = cpus;
+	}
+	vmtrace_enabled = true;
+	return 0;
+}
+
+void
+vmtrace_stop(void)
+{
+	unsigned i;
+
+	vmtrace_enabled = false;
+
+	/* Wait out records already under way */
+	for (i = 0; i < vmtrace_ncpus; i++) {
+		spinlock_acquire(&vmtrace_cpus[i].tc_lock);
+		spinlock_release(&vmtrace_cpus[i].tc_lock);
+	}
+}
+
+/*
+ * Index in tc_recs of the Nth oldest record of TC.
+ */
+static
+unsigned
+vmtrace_slot(struct vmtrace_cpu *tc, unsigned n)
+{
+	return (tc->tc_next + VMTRACE_NRECS - tc->tc_count + n) %
+		VMTRACE_NRECS;
+}
+
+static
+int
+vmtrace_write(struct vnode *vn, char *buf, size_t len, off_t *offset)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	uio_kinit(&iov, &u, buf, len, *offset, UIO_WRITE);
+	result = VOP_WRITE(vn, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return ENOSPC;
+	}
+	*offset = u.uio_offset;
+	return 0;
+}
+
+int
+vmtrace_dump(const char *path)
+{
+	struct vmtrace_cpu *tc;
+	struct vmtrace_rec *r, *best;
+	struct vnode *vn;
+	unsigned *pos;
+	unsigned i, bestcpu, lost;
+	char *pathcopy, *buf;
+	size_t len;
+	off_t offset;
+	uint32_t cycles_per_us, nsecs;
+	bool was_enabled;
+	int result;
+
+	if (vmtrace_cpus == NULL) {
+		return ENOENT;
+	}
+
+	/* vfs_open destroys the string it is passed */
+	pathcopy = kstrdup(path);
+	buf = kmalloc(PAGE_SIZE);
+	pos = kmalloc(vmtrace_ncpus * sizeof(unsigned));
+	if (pathcopy == NULL || buf == NULL || pos == NULL) {
+		kfree(pathcopy);
+		kfree(buf);
+		kfree(pos);
+		return ENOMEM;
+	}
+	result = vfs_open(pathcopy, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	kfree(pathcopy);
+	if (result) {
+		kfree(buf);
+		kfree(pos);
+		return result;
+	}
+
+	/* The rings stay still while we read them */
+	was_enabled = vmtrace_enabled;
+	vmtrace_stop();
+
+	lost = 0;
+	for (i = 0; i < vmtrace_ncpus; i++) {
+		pos[i] = 0;
+		lost += vmtrace_cpus[i].tc_lost;
+	}
+	cycles_per_us = vmtrace_freq / 1000000;
+	offset = 0;
+	len = snprintf(buf, PAGE_SIZE, "# vmtrace: %u cpus, %u records lost\n",
+		       vmtrace_ncpus, lost);
+
+	/* Merge the rings, oldest record first */
+	while (1) {
+		best = NULL;
+		bestcpu = 0;
+		for (i = 0; i < vmtrace_ncpus; i++) {
+			tc = &vmtrace_cpus[i];
+			if (pos[i] == tc->tc_count) {
+				continue;
+			}
+			r = &tc->tc_recs[vmtrace_slot(tc, pos[i])];
+			if (best == NULL || r->vt_secs < best->vt_secs ||
+			    (r->vt_secs == best->vt_secs &&
+			     r->vt_cycles < best->vt_cycles)) {
+				best = r;
+				bestcpu = i;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		pos[bestcpu]++;
+
+		if (PAGE_SIZE - len < 80) {
+			result = vmtrace_write(vn, buf, len, &offset);
+			if (result) {
+				break;
+			}
+			len = 0;
+		}
+		/* in two parts, so no product overflows 32 bits */
+		nsecs = best->vt_cycles / cycles_per_us * 1000 +
+			best->vt_cycles % cycles_per_us * 1000 / cycles_per_us;
+		len += snprintf(buf + len, PAGE_SIZE - len,
+				"%u.%09u %u %c %c %08x %05x %d\n",
+				best->vt_secs, nsecs, bestcpu,
+				best->vt_kind, best->vt_rw, best->vt_as,
+				best->vt_vpn, best->vt_frame);
+	}
+	if (result == 0) {
+		result = vmtrace_write(vn, buf, len, &offset);
+	}
+	vfs_close(vn);
+
+	if (result == 0) {
+		for (i = 0; i < vmtrace_ncpus; i++) {
+			vmtrace_cpus[i].tc_next = 0;
+			vmtrace_cpus[i].tc_count = 0;
+			vmtrace_cpus[i].tc_lost = 0;
+		}
+	}
+	vmtrace_enabled = was_enabled;
+
+	kfree(buf);
+	kfree(pos);
+	return result;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * refill.c
+ *
+ * 	Measures the cost of a TLB refill as the address space grows.
+ *	The array below is 32M of bss, so the kernel defines a page
+ *	table entry for each of its 8192 pages, though few are touched.
+ *	Each sweep touches the same number of pages, more than the TLB
+ *	holds, spaced out at a stride that doubles from one sweep to the
+ *	next: from 128 adjacent pages up to one page in 64 across the
+ *	whole array. Every access takes a TLB miss on a page that is
+ *	already resident; the average time per access is printed.
+ *
+ * With a page table lookup that does not depend on where the page is
+ * or how much of the address space is in use, the numbers printed
+ * should stay roughly flat. Run it with enough RAM configured in
+ * sys161.conf to hold every page touched over all sweeps (2M),
+ * otherwise page faults will dominate the later ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PageSize	4096
+#define NumPages	8192
+#define Touched		128	/* pages in each sweep, twice the TLB */
+#define Rounds		20
+
+int pages[NumPages][PageSize/sizeof(int)];	/* only the first word of each row is used */
+
+static
+void
+sweep(int stride)
+{
+	time_t s1, s2;
+	unsigned long ns1, ns2;
+	long long elapsed;
+	int i, r;
+
+	/* make sure every page in the working set is resident */
+	for (i=0; i<Touched; i++) {
+		pages[i*stride][0] = i;
+	}
+
+	__time(&s1, &ns1);
+	for (r=0; r<Rounds; r++) {
+		for (i=0; i<Touched; i++) {
+			pages[i*stride][0]++;
+		}
+	}
+	__time(&s2, &ns2);
+
+	elapsed = (long long)(s2 - s1) * 1000000000LL + (long long)ns2 - (long long)ns1;
+
+	printstring("span ");
+	printint(Touched * stride);
+	printstring(" pages: ");
+	printint((int)(elapsed / ((long long)Touched * Rounds)));
+	printstring(" ns per access\n");
+}
+
+int
+main()
+{
+	int stride;
+
+	printstring("Entering the refill benchmark\n");
+
+	for (stride=1; stride*Touched<=NumPages; stride*=2) {
+		sweep(stride);
+	}
+
+	printstring("refill done\n");
+	__exit();
+
+	return 0;
+}
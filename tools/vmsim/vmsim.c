@@ -0,0 +1,705 @@
+/*
+ * vmsim - replay an OS/161 page fault trace against page replacement
+ * policies, on the host.
+ *
+ * The trace is what the kernel menu command "vmtrace dump" writes
+ * (see kern/include/vmtrace.h). Every fault in it is taken as one
+ * reference to its page; an address space exit frees its pages.
+ * The kernel's own evictions are only counted.
+ *
+ * The trace holds the references that reached vm_fault, not every
+ * memory access: a page whose translation stays in the TLB, or that
+ * the refill handler can load, is not seen again until its reference
+ * bit is cleared. It is a sample of the reference string, taken
+ * more densely for pages the kernel was about to evict, which is
+ * where the policies differ.
+ *
+ * Policies:
+ *     fifo    - evict the page loaded longest ago.
+ *     refscan - the kernel's original policy: the first unreferenced
+ *               frame from frame 0, else frame 0's page; reference
+ *               bits are cleared every -r seconds of trace time.
+ *     clock   - second chance with a persistent hand.
+ *     lru     - evict the page used longest ago.
+ *     arc     - adaptive replacement cache (Megiddo and Modha).
+ *     opt     - evict the page used again furthest in the future.
+ *
+ * Usage: vmsim [-f frames[,frames...]] [-p policy[,policy...]]
+ *              [-r secs] tracefile
+ *
+ * Without -f, the frame count is the number of frames the trace
+ * shows the kernel using. Without -p, every policy is run.
+ *
+ * Build with: cc -O2 -o vmsim vmsim.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NEVER SIZE_MAX
+
+struct ref {
+	uint64_t r_key;		/* address space and page; 0 for exits */
+	uint32_t r_as;
+	uint64_t r_time;	/* nanoseconds */
+	int r_write;
+	int r_exit;
+};
+
+static struct ref *refs;
+static size_t nrefs;
+static size_t *nextuse;		/* index of the next reference to the page */
+
+static unsigned trace_minor, trace_major, trace_evict, trace_exits;
+static unsigned trace_maxframe;
+
+#define MKKEY(as, vpn) (((uint64_t)(as) << 20) | (vpn))
+#define KEY_AS(key) ((uint32_t)((key) >> 20))
+
+/* ARC lists */
+#define L_NONE 0
+#define L_T1 1
+#define L_T2 2
+#define L_B1 3
+#define L_B2 4
+
+struct page {
+	uint64_t key;
+	int frame;		/* -1 for ARC ghosts */
+	int list;		/* ARC only */
+	int ref;
+	int dirty;
+	size_t loaded;		/* reference that brought it in */
+	size_t used;		/* last reference to it */
+	size_t next;		/* next reference to it, or NEVER */
+	struct page *hnext;
+	struct page *prev, *lnext;
+};
+
+struct result {
+	unsigned long faults;
+	unsigned long writebacks;
+};
+
+////////////////////////////////////////////////////////////
+// page lookup
+
+#define HASHSIZE 65536
+
+static struct page *hashtab[HASHSIZE];
+
+static
+unsigned
+hashkey(uint64_t key)
+{
+	key ^= key >> 29;
+	key *= 0x9e3779b97f4a7c15ULL;
+	return (unsigned)(key >> 48) & (HASHSIZE - 1);
+}
+
+static
+struct page *
+lookup(uint64_t key)
+{
+	struct page *p;
+
+	for (p = hashtab[hashkey(key)]; p != NULL; p = p->hnext) {
+		if (p->key == key) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static
+struct page *
+page_new(uint64_t key)
+{
+	struct page *p;
+	unsigned h = hashkey(key);
+
+	p = calloc(1, sizeof(*p));
+	if (p == NULL) {
+		fprintf(stderr, "vmsim: out of memory\n");
+		exit(1);
+	}
+	p->key = key;
+	p->frame = -1;
+	p->hnext = hashtab[h];
+	hashtab[h] = p;
+	return p;
+}
+
+static
+void
+page_free(struct page *p)
+{
+	struct page **pp;
+
+	for (pp = &hashtab[hashkey(p->key)]; *pp != p; pp = &(*pp)->hnext)
+		;
+	*pp = p->hnext;
+	free(p);
+}
+
+static
+void
+hash_clear(void)
+{
+	struct page *p, *next;
+	unsigned i;
+
+	for (i = 0; i < HASHSIZE; i++) {
+		for (p = hashtab[i]; p != NULL; p = next) {
+			next = p->hnext;
+			free(p);
+		}
+		hashtab[i] = NULL;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// frame-based policies
+
+struct sim {
+	struct page **frames;
+	unsigned nframes;
+	unsigned hand;
+	int policy;
+	uint64_t reset_ns;	/* refscan reset interval */
+	uint64_t next_reset;
+};
+
+#define P_FIFO 0
+#define P_REFSCAN 1
+#define P_CLOCK 2
+#define P_LRU 3
+#define P_ARC 4
+#define P_OPT 5
+#define NPOLICIES 6
+
+static const char *const policy_names[NPOLICIES] = {
+	"fifo", "refscan", "clock", "lru", "arc", "opt",
+};
+
+static
+unsigned
+choose_victim(struct sim *s)
+{
+	unsigned i, best;
+
+	switch (s->policy) {
+	    case P_FIFO:
+	    case P_LRU:
+	    case P_OPT:
+		best = 0;
+		for (i = 1; i < s->nframes; i++) {
+			struct page *a = s->frames[i], *b = s->frames[best];
+			if ((s->policy == P_FIFO && a->loaded < b->loaded) ||
+			    (s->policy == P_LRU && a->used < b->used) ||
+			    (s->policy == P_OPT && a->next > b->next)) {
+				best = i;
+			}
+		}
+		return best;
+	    case P_REFSCAN:
+		for (i = 0; i < s->nframes; i++) {
+			if (!s->frames[i]->ref) {
+				return i;
+			}
+		}
+		return 0;
+	    case P_CLOCK:
+		while (1) {
+			i = s->hand;
+			s->hand = (s->hand + 1) % s->nframes;
+			if (!s->frames[i]->ref) {
+				return i;
+			}
+			s->frames[i]->ref = 0;
+		}
+	}
+	abort();
+}
+
+static
+void
+sim_frames(int policy, unsigned nframes, double reset_secs, struct result *res)
+{
+	struct sim s;
+	struct page *p;
+	size_t i;
+	unsigned f;
+
+	memset(&s, 0, sizeof(s));
+	s.frames = calloc(nframes, sizeof(struct page *));
+	if (s.frames == NULL) {
+		fprintf(stderr, "vmsim: out of memory\n");
+		exit(1);
+	}
+	s.nframes = nframes;
+	s.policy = policy;
+	s.reset_ns = (uint64_t)(reset_secs * 1e9);
+	s.next_reset = nrefs > 0 ? refs[0].r_time + s.reset_ns : 0;
+
+	for (i = 0; i < nrefs; i++) {
+		if (policy == P_REFSCAN && s.reset_ns > 0) {
+			while (refs[i].r_time >= s.next_reset) {
+				for (f = 0; f < nframes; f++) {
+					if (s.frames[f] != NULL) {
+						s.frames[f]->ref = 0;
+					}
+				}
+				s.next_reset += s.reset_ns;
+			}
+		}
+
+		if (refs[i].r_exit) {
+			for (f = 0; f < nframes; f++) {
+				p = s.frames[f];
+				if (p != NULL && KEY_AS(p->key) == refs[i].r_as) {
+					s.frames[f] = NULL;
+					page_free(p);
+				}
+			}
+			continue;
+		}
+
+		p = lookup(refs[i].r_key);
+		if (p == NULL) {
+			res->faults++;
+			for (f = 0; f < nframes; f++) {
+				if (s.frames[f] == NULL) {
+					break;
+				}
+			}
+			if (f == nframes) {
+				f = choose_victim(&s);
+				if (s.frames[f]->dirty) {
+					res->writebacks++;
+				}
+				page_free(s.frames[f]);
+			}
+			p = page_new(refs[i].r_key);
+			p->frame = f;
+			p->loaded = i;
+			s.frames[f] = p;
+		}
+		p->ref = 1;
+		p->used = i;
+		p->next = nextuse[i];
+		if (refs[i].r_write) {
+			p->dirty = 1;
+		}
+	}
+
+	hash_clear();
+	free(s.frames);
+}
+
+////////////////////////////////////////////////////////////
+// ARC
+
+struct arclist {
+	struct page *head;	/* MRU end */
+	struct page *tail;	/* LRU end */
+	unsigned len;
+};
+
+static struct arclist arc[5];
+
+static
+void
+arc_remove(struct page *p)
+{
+	struct arclist *l = &arc[p->list];
+
+	if (p->prev != NULL) p->prev->lnext = p->lnext;
+	else l->head = p->lnext;
+	if (p->lnext != NULL) p->lnext->prev = p->prev;
+	else l->tail = p->prev;
+	l->len--;
+	p->prev = p->lnext = NULL;
+	p->list = L_NONE;
+}
+
+static
+void
+arc_push(struct page *p, int list)
+{
+	struct arclist *l = &arc[list];
+
+	if (p->list != L_NONE) {
+		arc_remove(p);
+	}
+	p->list = list;
+	p->prev = NULL;
+	p->lnext = l->head;
+	if (l->head != NULL) l->head->prev = p;
+	else l->tail = p;
+	l->head = p;
+	l->len++;
+}
+
+/*
+ * Evict the LRU page of T1 or T2 to the matching ghost list.
+ */
+static
+void
+arc_replace(int in_b2, unsigned target, struct result *res)
+{
+	struct page *p;
+
+	if (arc[L_T1].len >= 1 &&
+	    ((in_b2 && arc[L_T1].len == target) || arc[L_T1].len > target ||
+	     arc[L_T2].len == 0)) {
+		p = arc[L_T1].tail;
+		arc_push(p, L_B1);
+	}
+	else {
+		p = arc[L_T2].tail;
+		arc_push(p, L_B2);
+	}
+	if (p->dirty) {
+		res->writebacks++;
+	}
+	p->dirty = 0;
+	p->frame = -1;
+}
+
+static
+void
+arc_drop(struct page *p)
+{
+	arc_remove(p);
+	page_free(p);
+}
+
+static
+void
+sim_arc(unsigned c, struct result *res)
+{
+	struct page *p, *next;
+	unsigned target = 0, resident, d;
+	size_t i;
+	int l;
+
+	memset(arc, 0, sizeof(arc));
+	for (i = 0; i < nrefs; i++) {
+		if (refs[i].r_exit) {
+			for (l = L_T1; l <= L_B2; l++) {
+				for (p = arc[l].head; p != NULL; p = next) {
+					next = p->lnext;
+					if (KEY_AS(p->key) == refs[i].r_as) {
+						arc_drop(p);
+					}
+				}
+			}
+			continue;
+		}
+
+		resident = arc[L_T1].len + arc[L_T2].len;
+		p = lookup(refs[i].r_key);
+		if (p != NULL && (p->list == L_T1 || p->list == L_T2)) {
+			/* hit */
+			arc_push(p, L_T2);
+		}
+		else if (p != NULL && p->list == L_B1) {
+			res->faults++;
+			d = arc[L_B2].len / arc[L_B1].len;
+			target += d > 1 ? d : 1;
+			if (target > c) target = c;
+			if (resident >= c) arc_replace(0, target, res);
+			arc_push(p, L_T2);
+		}
+		else if (p != NULL && p->list == L_B2) {
+			res->faults++;
+			d = arc[L_B1].len / arc[L_B2].len;
+			d = d > 1 ? d : 1;
+			target = target > d ? target - d : 0;
+			if (resident >= c) arc_replace(1, target, res);
+			arc_push(p, L_T2);
+		}
+		else {
+			res->faults++;
+			if (arc[L_T1].len + arc[L_B1].len >= c) {
+				if (arc[L_T1].len < c) {
+					arc_drop(arc[L_B1].tail);
+					if (resident >= c) arc_replace(0, target, res);
+				}
+				else {
+					p = arc[L_T1].tail;
+					if (p->dirty) res->writebacks++;
+					arc_drop(p);
+				}
+			}
+			else if (resident + arc[L_B1].len + arc[L_B2].len >= c) {
+				if (resident + arc[L_B1].len + arc[L_B2].len >= 2 * c &&
+				    arc[L_B2].len > 0) {
+					arc_drop(arc[L_B2].tail);
+				}
+				if (resident >= c) arc_replace(0, target, res);
+			}
+			p = page_new(refs[i].r_key);
+			arc_push(p, L_T1);
+		}
+		p->frame = 0;
+		if (refs[i].r_write) {
+			p->dirty = 1;
+		}
+	}
+
+	hash_clear();
+}
+
+////////////////////////////////////////////////////////////
+// trace input
+
+static
+void
+addref(const struct ref *r)
+{
+	static size_t max;
+
+	if (nrefs == max) {
+		max = max ? max * 2 : 4096;
+		refs = realloc(refs, max * sizeof(struct ref));
+		if (refs == NULL) {
+			fprintf(stderr, "vmsim: out of memory\n");
+			exit(1);
+		}
+	}
+	refs[nrefs++] = *r;
+}
+
+static
+void
+readtrace(const char *path)
+{
+	FILE *f;
+	char line[256];
+	unsigned long secs, nsecs;
+	unsigned cpu, as, vpn;
+	char kind, rw;
+	int frame;
+	unsigned lineno = 0;
+	struct ref r;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n') {
+			continue;
+		}
+		if (sscanf(line, "%lu.%lu %u %c %c %x %x %d", &secs, &nsecs,
+			   &cpu, &kind, &rw, &as, &vpn, &frame) != 8) {
+			fprintf(stderr, "%s:%u: bad line\n", path, lineno);
+			exit(1);
+		}
+		memset(&r, 0, sizeof(r));
+		r.r_time = (uint64_t)secs * 1000000000ULL + nsecs;
+		r.r_as = as;
+		switch (kind) {
+		    case 'm':
+		    case 'M':
+			if (kind == 'm') trace_minor++;
+			else trace_major++;
+			if (frame >= 0 && (unsigned)frame + 1 > trace_maxframe) {
+				trace_maxframe = frame + 1;
+			}
+			r.r_key = MKKEY(as, vpn);
+			r.r_write = (rw == 'w');
+			addref(&r);
+			break;
+		    case 'E':
+			trace_evict++;
+			break;
+		    case 'X':
+			trace_exits++;
+			r.r_exit = 1;
+			addref(&r);
+			break;
+		    default:
+			fprintf(stderr, "%s:%u: unknown event %c\n",
+				path, lineno, kind);
+			exit(1);
+		}
+	}
+	fclose(f);
+}
+
+/*
+ * For OPT: index of the next reference to the same page, computed
+ * backwards with the page table as a map from page to reference. A
+ * reference after the page's address space exits is to a new address
+ * space at the same kernel address, so it does not count.
+ */
+static
+void
+compute_nextuse(void)
+{
+	struct exitmark {
+		uint32_t as;
+		size_t at;	/* the exit at or after the reference */
+	} *marks = NULL;
+	size_t nmarks = 0, m, i, exit_at;
+	struct page *p;
+
+	nextuse = malloc((nrefs + 1) * sizeof(size_t));
+	if (nextuse == NULL) {
+		fprintf(stderr, "vmsim: out of memory\n");
+		exit(1);
+	}
+	for (i = nrefs; i-- > 0; ) {
+		if (refs[i].r_exit) {
+			nextuse[i] = NEVER;
+			for (m = 0; m < nmarks; m++) {
+				if (marks[m].as == refs[i].r_as) {
+					break;
+				}
+			}
+			if (m == nmarks) {
+				marks = realloc(marks, ++nmarks * sizeof(*marks));
+				if (marks == NULL) {
+					fprintf(stderr, "vmsim: out of memory\n");
+					exit(1);
+				}
+				marks[m].as = refs[i].r_as;
+			}
+			marks[m].at = i;
+			continue;
+		}
+		exit_at = NEVER;
+		for (m = 0; m < nmarks; m++) {
+			if (marks[m].as == KEY_AS(refs[i].r_key)) {
+				exit_at = marks[m].at;
+				break;
+			}
+		}
+		p = lookup(refs[i].r_key);
+		if (p == NULL) {
+			p = page_new(refs[i].r_key);
+			p->next = NEVER;
+		}
+		nextuse[i] = p->next < exit_at ? p->next : NEVER;
+		p->next = i;
+	}
+	free(marks);
+	hash_clear();
+}
+
+////////////////////////////////////////////////////////////
+
+static
+void
+usage(void)
+{
+	fprintf(stderr, "Usage: vmsim [-f frames[,frames...]] "
+		"[-p policy[,policy...]] [-r secs] tracefile\n");
+	exit(1);
+}
+
+static
+int
+policy_byname(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NPOLICIES; i++) {
+		if (!strcmp(name, policy_names[i])) {
+			return i;
+		}
+	}
+	fprintf(stderr, "vmsim: unknown policy %s\n", name);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned framelist[64];
+	int policies[NPOLICIES];
+	unsigned nframelist = 0, npolicies = 0, fi, pi;
+	double reset_secs = 10;
+	struct result res;
+	char *s, *tok;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "f:p:r:")) != -1) {
+		switch (ch) {
+		    case 'f':
+			for (s = optarg; (tok = strtok(s, ",")) != NULL; s = NULL) {
+				if (nframelist == 64 || atoi(tok) <= 0) {
+					usage();
+				}
+				framelist[nframelist++] = atoi(tok);
+			}
+			break;
+		    case 'p':
+			for (s = optarg; (tok = strtok(s, ",")) != NULL; s = NULL) {
+				if (npolicies == NPOLICIES) {
+					usage();
+				}
+				policies[npolicies++] = policy_byname(tok);
+			}
+			break;
+		    case 'r':
+			reset_secs = atof(optarg);
+			break;
+		    default:
+			usage();
+		}
+	}
+	if (optind != argc - 1) {
+		usage();
+	}
+
+	readtrace(argv[optind]);
+	compute_nextuse();
+
+	if (npolicies == 0) {
+		for (pi = 0; pi < NPOLICIES; pi++) {
+			policies[npolicies++] = pi;
+		}
+	}
+	if (nframelist == 0) {
+		if (trace_maxframe == 0) {
+			fprintf(stderr, "vmsim: no faults in trace; use -f\n");
+			exit(1);
+		}
+		framelist[nframelist++] = trace_maxframe;
+	}
+
+	printf("trace: %u faults (%u minor, %u major), %u exits, "
+	       "%u kernel evictions\n",
+	       trace_minor + trace_major, trace_minor, trace_major,
+	       trace_exits, trace_evict);
+	printf("%8s  %-8s %10s %7s %10s\n",
+	       "frames", "policy", "faults", "fault%", "writebacks");
+	for (fi = 0; fi < nframelist; fi++) {
+		for (pi = 0; pi < npolicies; pi++) {
+			memset(&res, 0, sizeof(res));
+			if (policies[pi] == P_ARC) {
+				sim_arc(framelist[fi], &res);
+			}
+			else {
+				sim_frames(policies[pi], framelist[fi],
+					   reset_secs, &res);
+			}
+			printf("%8u  %-8s %10lu %6.2f%% %10lu\n",
+			       framelist[fi], policy_names[policies[pi]],
+			       res.faults,
+			       nrefs ? 100.0 * res.faults /
+			       (trace_minor + trace_major) : 0.0,
+			       res.writebacks);
+		}
+	}
+	return 0;
+}